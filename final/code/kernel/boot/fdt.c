@@ -0,0 +1,294 @@
+// 扁平设备树(Flattened Device Tree)解析
+//
+// QEMU在跳转到内核时把设备树的物理地址放在a1寄存器中。
+// 这里只做一次线性扫描，提取内核关心的少量信息：
+// 内存大小、CPU数量，UART、PLIC、virtio、CLINT的MMIO地址，以及启动参数。
+// 设备树通常位于内存末尾，必须在kinit()之前解析完毕，
+// 之后不再访问它，它所在的内存可以正常分配。
+
+#include "../type.h"
+#include "../def.h"
+#include "../mm/memlayout.h"
+#include "../proc/proc.h"
+#include "../utils/string.h"
+#include "fdt.h"
+
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 0x1
+#define FDT_END_NODE   0x2
+#define FDT_PROP       0x3
+#define FDT_NOP        0x4
+#define FDT_END        0x9
+
+#define FDT_MAXDEPTH   16
+
+// 设备树头部，所有字段均为大端序
+struct fdt_header {
+  uint32 magic;
+  uint32 totalsize;
+  uint32 off_dt_struct;
+  uint32 off_dt_strings;
+  uint32 off_mem_rsvmap;
+  uint32 version;
+  uint32 last_comp_version;
+  uint32 boot_cpuid_phys;
+  uint32 size_dt_strings;
+  uint32 size_dt_struct;
+};
+
+uint64 dtb_pa;
+
+// 默认值与memlayout.h一致，对应 qemu -machine virt -m 128M -smp 1
+struct machine machine = {
+  .mem_base = KERNBASE,
+  .mem_size = PHYSTOP_DEFAULT - KERNBASE,
+  .ncpu = 1,
+  .uart_base = UART0,
+  .uart_irq = UART0_IRQ,
+  .plic_base = PLIC,
+  .plic_size = 0x4000000,
+  .virtio_base = VIRTIO0,
+  .virtio_irq = VIRTIO0_IRQ,
+  .clint_base = 0x2000000L,
+};
+
+// 物理内存上界，供PHYSTOP宏使用
+uint64 phystop = PHYSTOP_DEFAULT;
+
+static uint32
+be32(const void *p)
+{
+  const uchar *b = (const uchar*)p;
+  return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// 读取由ncells个32位单元组成的大端数
+static uint64
+read_cells(const uchar *p, int ncells)
+{
+  uint64 v = 0;
+  for(int i = 0; i < ncells; i++)
+    v = (v << 32) | be32(p + 4*i);
+  return v;
+}
+
+static int
+str_eq(const char *a, const char *b)
+{
+  while(*a && *a == *b)
+    a++, b++;
+  return *a == *b;
+}
+
+// 节点名是否以prefix开头，后面紧跟'@'或结束
+static int
+node_is(const char *name, const char *prefix)
+{
+  while(*prefix && *name == *prefix)
+    name++, prefix++;
+  return *prefix == 0 && (*name == 0 || *name == '@');
+}
+
+// compatible属性是一组以'\0'分隔的字符串，检查其中是否包含s
+static int
+compat_has(const char *list, int len, const char *s)
+{
+  int i = 0;
+  while(i < len){
+    if(str_eq(list + i, s))
+      return 1;
+    while(i < len && list[i])
+      i++;
+    i++;
+  }
+  return 0;
+}
+
+// 当前节点解析过程中收集到的属性
+struct fdt_node {
+  const char *name;
+  const uchar *reg;       // reg属性
+  int reglen;
+  const char *compat;     // compatible属性
+  int compatlen;
+  const char *devtype;    // device_type属性
+  const char *status;     // status属性
+  int irq;                // interrupts属性的第一个值
+};
+
+// 节点结束时根据收集到的属性更新machine
+static void
+fdt_node_done(struct fdt_node *n, int depth, const char *parent,
+              int acells, int scells)
+{
+  uint64 base = 0, size = 0;
+
+  if(n->status && !str_eq(n->status, "okay"))
+    return;
+  if(n->reg && n->reglen >= 4*(acells + scells)){
+    base = read_cells(n->reg, acells);
+    size = read_cells(n->reg + 4*acells, scells);
+  }
+
+  if(depth == 1 && n->devtype && str_eq(n->devtype, "memory")){
+    if(n->reg && base == KERNBASE){
+      machine.mem_base = base;
+      machine.mem_size = size;
+    }
+  } else if(depth == 2 && parent && str_eq(parent, "cpus") &&
+            (node_is(n->name, "cpu") ||
+             (n->devtype && str_eq(n->devtype, "cpu")))){
+    machine.ncpu++;
+  } else if(n->compat){
+    if(compat_has(n->compat, n->compatlen, "ns16550a")){
+      machine.uart_base = base;
+      machine.uart_irq = n->irq;
+    } else if(compat_has(n->compat, n->compatlen, "riscv,plic0")){
+      machine.plic_base = base;
+      machine.plic_size = size;
+    } else if(compat_has(n->compat, n->compatlen, "virtio,mmio")){
+      // 设备树中virtio设备按地址降序排列，取地址最低的一个（即virtio0）
+      if(machine.virtio_base == 0 || base < machine.virtio_base){
+        machine.virtio_base = base;
+        machine.virtio_irq = n->irq;
+      }
+    } else if(compat_has(n->compat, n->compatlen, "riscv,clint0")){
+      machine.clint_base = base;
+    }
+  }
+}
+
+// 解析设备树，失败时保留默认值
+void
+fdt_init(uint64 dtb)
+{
+  const struct fdt_header *h = (const struct fdt_header*)dtb;
+  const uchar *p, *strings;
+  struct fdt_node node[FDT_MAXDEPTH];
+  int acells[FDT_MAXDEPTH], scells[FDT_MAXDEPTH]; // 各层子节点使用的cells数
+  int depth = 0;
+
+  if(dtb == 0 || be32(&h->magic) != FDT_MAGIC){
+    printf("fdt: no device tree, using default memory layout\n");
+    return;
+  }
+
+  p = (const uchar*)dtb + be32(&h->off_dt_struct);
+  strings = (const uchar*)dtb + be32(&h->off_dt_strings);
+  acells[0] = 2;
+  scells[0] = 1;
+
+  machine.ncpu = 0;
+  machine.virtio_base = 0;
+
+  for(;;){
+    uint32 tok = be32(p);
+    p += 4;
+
+    if(tok == FDT_BEGIN_NODE){
+      if(depth >= FDT_MAXDEPTH - 1)
+        panic("fdt: tree too deep");
+      const char *name = (const char*)p;
+      int len = strlen(name);
+      p += (len + 4) & ~3;        // 名字以'\0'结尾并按4字节对齐
+
+      struct fdt_node *n = &node[depth];
+      memset(n, 0, sizeof(*n));
+      n->name = name;
+      n->irq = -1;
+      // 子节点默认继承父节点的cells设置，直到遇到#address-cells属性
+      acells[depth + 1] = acells[depth];
+      scells[depth + 1] = scells[depth];
+      depth++;
+    } else if(tok == FDT_END_NODE){
+      if(depth == 0)
+        break;
+      depth--;
+      fdt_node_done(&node[depth], depth, depth > 0 ? node[depth-1].name : 0,
+                    depth > 0 ? acells[depth] : 2, depth > 0 ? scells[depth] : 1);
+    } else if(tok == FDT_PROP){
+      uint32 len = be32(p);
+      const char *pname = (const char*)strings + be32(p + 4);
+      const uchar *val = p + 8;
+      p += 8 + ((len + 3) & ~3);
+      if(depth == 0)
+        continue;
+
+      struct fdt_node *n = &node[depth - 1];
+      if(str_eq(pname, "reg")){
+        n->reg = val;
+        n->reglen = len;
+      } else if(str_eq(pname, "compatible")){
+        n->compat = (const char*)val;
+        n->compatlen = len;
+      } else if(str_eq(pname, "device_type")){
+        n->devtype = (const char*)val;
+      } else if(str_eq(pname, "status")){
+        n->status = (const char*)val;
+      } else if(str_eq(pname, "interrupts")){
+        n->irq = be32(val);
+      } else if(str_eq(pname, "#address-cells")){
+        acells[depth] = be32(val);
+      } else if(str_eq(pname, "#size-cells")){
+        scells[depth] = be32(val);
+      } else if(str_eq(pname, "bootargs") && depth == 2 && str_eq(n->name, "chosen")){
+        // 设备树所在的内存之后会被分配出去，复制一份
+        strncpy(machine.bootargs, (const char*)val, sizeof(machine.bootargs) - 1);
+      }
+    } else if(tok == FDT_NOP){
+      continue;
+    } else {
+      break; // FDT_END或非法token
+    }
+  }
+
+  if(machine.ncpu == 0)
+    machine.ncpu = 1;
+  if(machine.ncpu > NCPU)
+    machine.ncpu = NCPU;
+  if(machine.virtio_base == 0)
+    machine.virtio_base = VIRTIO0;
+
+  // 内核的直接映射从KERNBASE开始，内存必须从这里开始
+  if(machine.mem_base == KERNBASE && machine.mem_size >= PGSIZE)
+    phystop = PGROUNDDOWN(machine.mem_base + machine.mem_size);
+}
+
+void
+fdt_print(void)
+{
+  printf("machine: %d MiB RAM @ 0x%x, %d cpu(s)\n",
+         (int)(machine.mem_size >> 20), (int)machine.mem_base, machine.ncpu);
+  printf("  uart 0x%x irq %d, plic 0x%x, virtio 0x%x irq %d, clint 0x%x\n",
+         (int)machine.uart_base, machine.uart_irq, (int)machine.plic_base,
+         (int)machine.virtio_base, machine.virtio_irq, (int)machine.clint_base);
+  if(machine.bootargs[0])
+    printf("  bootargs: %s\n", machine.bootargs);
+}
+
+// 在启动参数（以空格分隔的key=value）中查找key，把它的值复制到buf
+// （最多n-1个字符，以'\0'结尾），返回值的长度；没有这个参数时返回-1
+int
+bootarg(const char *key, char *buf, int n)
+{
+  const char *s = machine.bootargs;
+  int klen = strlen(key), len;
+
+  if(n <= 0)
+    return -1;
+  while(*s){
+    while(*s == ' ')
+      s++;
+    if(strncmp(s, key, klen) == 0 && s[klen] == '='){
+      s += klen + 1;
+      for(len = 0; s[len] && s[len] != ' '; len++)
+        if(len < n - 1)
+          buf[len] = s[len];
+      buf[len < n - 1 ? len : n - 1] = 0;
+      return len;
+    }
+    while(*s && *s != ' ')
+      s++;
+  }
+  return -1;
+}
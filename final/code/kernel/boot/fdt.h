@@ -0,0 +1,29 @@
+// 扁平设备树(FDT)解析结果
+#ifndef FDT_H
+#define FDT_H
+
+#include "../type.h"
+
+// 启动时从设备树得到的机器描述，解析失败时保留memlayout.h中的默认值
+struct machine {
+  uint64 mem_base;      // /memory 节点
+  uint64 mem_size;
+  int    ncpu;          // /cpus 下的 cpu 节点数
+  uint64 uart_base;     // ns16550a
+  int    uart_irq;
+  uint64 plic_base;     // riscv,plic0
+  uint64 plic_size;
+  uint64 virtio_base;   // 地址最低的 virtio,mmio 设备
+  int    virtio_irq;
+  uint64 clint_base;    // riscv,clint0
+  char   bootargs[128]; // /chosen 的 bootargs（qemu -append），没有时为空串
+};
+
+extern struct machine machine;
+extern uint64 dtb_pa;   // start()保存的设备树物理地址
+
+void fdt_init(uint64 dtb);
+void fdt_print(void);
+int  bootarg(const char *key, char *buf, int n);
+
+#endif // FDT_H
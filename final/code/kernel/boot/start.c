@@ -1,24 +1,40 @@
 // #include "types.h"
-// #include "param.h"
+#include "../param.h"
 #include "../mm/memlayout.h"
 // #include "riscv.h"
 #include "../def.h"
+#include "../proc/proc.h"
+#include "fdt.h"
 
 void main();
 void timerinit();
 
 // entry.S needs one stack per CPU.
-__attribute__ ((aligned (16))) char stack0[4096];
+__attribute__ ((aligned (16))) char stack0[BOOTSTACKSIZE * NCPU];
 
 // entry.S jumps here in machine mode on stack0.
+// QEMU passes the hartid in a0 and the device tree address in a1.
 void
-start()
+start(uint64 hartid, uint64 dtb)
 {
-  printf("start\n");
+  // keep each CPU's hartid in its tp register, for cpuid().
+  // printf()等会调用mycpu()，必须最先设置
+  w_tp(hartid);
+
+  if(hartid == 0){
+    printf("start\n");
+    // main()在kinit()之前解析设备树
+    dtb_pa = dtb;
+  }
+
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
   x |= MSTATUS_MPP_S;
+#ifdef CONFIG_RVV
+  // 内存操作函数使用向量指令（见utils/string.c）
+  x |= MSTATUS_VS_INITIAL;
+#endif
   w_mstatus(x);
 
   // set M Exception Program Counter to main, for mret.
@@ -41,11 +57,6 @@ start()
   // ask for clock interrupts.
   timerinit();
 
-  // keep each CPU's hartid in its tp register, for cpuid().
-  int id = r_mhartid();
-  w_tp(id);
-
-
   // switch to supervisor mode and jump to main().
   asm volatile("mret");
 }
@@ -60,8 +71,8 @@ timerinit()
   // enable the sstc extension (i.e. stimecmp).
   w_menvcfg(r_menvcfg() | (1L << 63)); 
   
-  // allow supervisor to use stimecmp and time.
-  w_mcounteren(r_mcounteren() | 2);
+  // allow supervisor to use stimecmp and time, and to read cycle.
+  w_mcounteren(r_mcounteren() | 2 | 1);
   
   // ask for the very first timer interrupt.
   w_stimecmp(r_time() + 1000000);
@@ -15,6 +15,7 @@
     } while(0)
 
 // ========== 控制台和输出函数 ==========
+void printfinit(void);
 void printint(long long value, int base, int sgn);
 void printf(const char *fmt, ...);
 void panic(char *s);
@@ -31,20 +32,61 @@ void cons_puts(const char *s);
 
 // ========== 内存管理函数 ==========
 void* kalloc(void);
+void* kalloc_zeroed(void);
+int   kzero_refill(int max);
 void  kfree(void *);
+void  kfree_batch(void **pa, int n);
 void  kinit(void);
+void  kmem_stats(void);
+void* kalloc_pages(int order);
+void  kfree_pages(void *pa, int order);
+void  buddy_stats(void);
+int   buddy_grow_deferred(int nchunk);
+uint64 buddy_nr_free(void);
+uint64 buddy_nr_managed(void);
+void  debug_mem_table(void);
+void  kcache_flush(void);
+void  reclaim_init(void);
+int   reclaim_pages(int nr);
+void  reclaim_check(void);
+int   reclaim_direct(void);
+void  reclaim_stats(void);
+void  ksm_init(void);
+void  ksm_tick(void);
+void  ksm_stats(void);
+void  kref_get(void *pa);
+int   kref_count(void *pa);
+void  vmalloc_init(void);
+void* vmalloc(uint64 size);
+void  vfree(void *addr);
+void  vmalloc_stats(void);
+void  vmap_flush(void);
 void* memset(void *dst, int c, uint n);
+void* memcpy(void *dst, const void *src, uint n);
+void* memmove(void *dst, const void *src, uint n);
+int   memcmp(const void *v1, const void *v2, uint n);
 
 // ========== 虚拟内存管理函数 ==========
+struct proc;
+extern pagetable_t kernel_pagetable;
 void        kvminit(void);
 void        kvminithart(void);
 void        kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int         mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t create_pagetable(void);
-void        free_pagetable(pagetable_t);
 pte_t*      walk(pagetable_t, uint64, int);
 uint64      walkaddr(pagetable_t, uint64);
 int         ismapped(pagetable_t, uint64);
+void        vmstats(pagetable_t, char *);
+void        uvmswitch(struct proc *);
+void        kvmswitch(void);
+void        uvmflush(struct proc *, uint64, uint64);
+pagetable_t uvmcreate(void);
+void        uvmfree(pagetable_t);
+int         uvmcopy(struct proc *, pagetable_t);
+int         vmfault(struct proc *, uint64, int);
+uint64      uvmdealloc(struct proc *, uint64, uint64);
+int         mmap_fault(struct proc *, uint64, int);
 
 // ========== 陷阱处理函数 ==========
 void trapinithart(void);
@@ -127,8 +169,10 @@ void handle_store_page_fault(struct trapframe *tf);
 struct proc;
 struct cpu;
 struct context;
+struct spinlock;
 
 void         procinit(void);
+int          cpuid(void);
 struct cpu*  mycpu(void);
 struct proc* myproc(void);
 int          create_process(void (*entry)(void), char *name, int priority);
@@ -136,11 +180,13 @@ void         yield(void);
 void         sched(void);
 void         scheduler(void) __attribute__((noreturn));
 void         forkret(void);
-void         sleep(void *chan);
+void         sleep(void *chan, struct spinlock *lk);
 void         wakeup(void *chan);
 void         exit(int status) __attribute__((noreturn));
 int          wait(int *status);
 int          kill(int pid);
+int          fork(void (*entry)(void));
+int          exec(char *path, char **argv);
 void         debug_proc_table(void);
 void         push_off(void);
 void         pop_off(void);
@@ -151,5 +197,6 @@ struct file;
 
 void         fileinit(void);
 void         fileclose(struct file *f);
+struct file* filedup(struct file *f);
 
 #endif // DEF_H
\ No newline at end of file
@@ -5,15 +5,23 @@
 // 1) 同步访问磁盘块，确保每个块只有一个内核副本
 //    且一次只有一个内核线程使用该副本。
 // 2) 缓存常用块，这样它们不需要从慢速磁盘重新读取。
+//
+// 缓冲区从slab缓存分配：初始化时预分配NBUF个，
+// 所有缓冲区都在使用中时再按需扩充，而不是panic。
+// 内存紧张时，扩充出来的空闲缓冲区由shrinker按LRU顺序释放。
 
 #include "../def.h"
+#include "../mm/slab.h"
+#include "../mm/page.h"
+#include "../mm/reclaim.h"
 #include "bio.h"
 #include "fs.h"
 
-#define NBUF 30  // 缓冲区数量
+#define NBUF 30  // 初始缓冲区数量
 
 struct {
-  struct buf buf[NBUF];
+  struct kmem_cache *cache;  // 缓冲区对象缓存
+  int nbuf;                  // 当前缓冲区数量
   
   // 双向循环链表，按最近使用排序
   // head.next 是最近使用的
@@ -21,21 +29,56 @@ struct {
   struct buf head;
 } bcache;
 
+// 分配一个新缓冲区并加入链表头部，失败返回0
+static struct buf* bgrow(void) {
+  struct buf *b;
+
+  if((b = kmem_cache_alloc(bcache.cache)) == 0)
+    return 0;
+  // 还没有磁盘驱动，未写过的块读出为0，与原来静态分配的缓冲区一致
+  memset(b, 0, sizeof(*b));
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+  bcache.nbuf++;
+  return b;
+}
+
+// bcache shrinker：从LRU尾部释放未被使用的缓冲区，最多保留NBUF个，
+// 返回归还给页分配器的页数
+static int bshrink(int nr) {
+  struct buf *b, *prev;
+
+  for(b = bcache.head.prev; b != &bcache.head && bcache.nbuf > NBUF; b = prev){
+    prev = b->prev;
+    if(b->refcnt != 0)
+      continue;
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    kmem_cache_free(bcache.cache, b);
+    bcache.nbuf--;
+  }
+  return kmem_cache_shrink(bcache.cache);
+}
+
+static struct shrinker bcache_shrinker = { .name = "bcache", .scan = bshrink };
+
 // 初始化块缓存
 void binit(void) {
-  struct buf *b;
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf), 0);
+  kmem_cache_set_owner(bcache.cache, PGO_BCACHE);
 
   // 创建链表
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  for(int i = 0; i < NBUF; i++){
+    if(bgrow() == 0)
+      panic("binit");
   }
   
-  printf("块缓存初始化完成，缓冲区数量: %d\n", NBUF);
+  register_shrinker(&bcache_shrinker);
+  printf("块缓存初始化完成，缓冲区数量: %d\n", bcache.nbuf);
 }
 
 // 查找设备dev上的块blockno
@@ -63,6 +106,15 @@ static struct buf* bget(uint dev, uint blockno) {
       return b;
     }
   }
+
+  // 所有缓冲区都在使用中，扩充缓存
+  if((b = bgrow()) != 0){
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->refcnt = 1;
+    return b;
+  }
   
   panic("bget: 没有可用缓冲区");
   return 0;  // 不会执行到这里
@@ -3,9 +3,10 @@
 // 文件描述符层。
 // 每个打开的文件由一个struct file表示，
 // 它是包装inode或管道的包装器，加上I/O偏移量。
-// 表ftable保存所有打开的文件。
+// file对象从slab缓存分配，数量不再受编译期常量限制。
 
 #include "../def.h"
+#include "../mm/slab.h"
 #include "file.h"
 #include "fs.h"
 #include "log.h"
@@ -13,23 +14,28 @@
 // 全局打开文件表（结构体在file.h中定义）
 struct ftable_struct ftable;
 
+static struct kmem_cache *file_cache;
+
+// 新分配的file清零
+static void file_ctor(void *obj) {
+  memset(obj, 0, sizeof(struct file));
+}
+
 // 文件表初始化
 void fileinit(void) {
+  file_cache = kmem_cache_create("file", sizeof(struct file), file_ctor);
   printf("文件表初始化完成\n");
 }
 
 // 为新打开的文件分配file结构
-// 扫描文件表寻找未引用的文件(f->ref == 0)
 struct file* filealloc(void) {
   struct file *f;
 
-  for(f = ftable.file; f < ftable.file + 100; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      return f;
-    }
-  }
-  return 0;
+  if((f = kmem_cache_alloc(file_cache)) == 0)
+    return 0;
+  f->ref = 1;
+  ftable.nfile++;
+  return f;
 }
 
 // 增加文件的引用计数
@@ -55,6 +61,8 @@ void fileclose(struct file *f) {
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
+  kmem_cache_free(file_cache, f);
+  ftable.nfile--;
 
   if(ff.type == FD_INODE || ff.type == FD_DEVICE){
     begin_op();
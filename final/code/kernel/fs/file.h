@@ -20,14 +20,17 @@ struct file {
 #define mkdev(m,n)  ((uint)((m)<<16| (n)))
 
 // 内存中的inode表（在fs.c中定义）
+// inode对象从slab缓存分配，按需增长
 struct itable_struct {
-  struct inode inode[50];  // NINODE = 50
+  struct inode *head;  // 所有内存inode组成的链表
+  int ninode;          // 链表中的inode数
 };
 extern struct itable_struct itable;
 
 // 打开文件表（在file.c中定义）
+// file对象从slab缓存分配，最后一次fileclose时归还
 struct ftable_struct {
-  struct file file[100];  // NFILE = 100
+  int nfile;           // 当前打开的file数
 };
 extern struct ftable_struct ftable;
 
@@ -16,6 +16,8 @@
 // =================================================================
 
 #include "../def.h"
+#include "../mm/slab.h"
+#include "../mm/mmap.h"
 #include "fs.h"
 #include "bio.h"    // 块 I/O (缓冲区缓存)
 #include "log.h"    // 日志
@@ -29,6 +31,9 @@ struct superblock sb;
 // 内存中的inode表（结构体在file.h中定义）
 struct itable_struct itable;
 
+// inode对象缓存
+static struct kmem_cache *inode_cache;
+
 // =================================================================
 // 第 1 层: 超级块与初始化
 // =================================================================
@@ -44,9 +49,7 @@ void readsb(int dev, struct superblock *sb) {
      struct buf *bp;
 
      bp = bread(dev, 1); // 读取第 1 块
-     for(int i = 0; i < sizeof(*sb); i++) {
-          ((char*)sb)[i] = bp->data[i]; // 内存复制
-     }
+     memcpy(sb, bp->data, sizeof(*sb));
      brelse(bp); // 释放缓冲区
 }
 
@@ -56,6 +59,9 @@ void readsb(int dev, struct superblock *sb) {
  * @param dev 设备号
  */
 void fsinit(int dev) {
+     if(inode_cache == 0)
+          inode_cache = kmem_cache_create("inode", sizeof(struct inode), 0);
+
      readsb(dev, &sb);
        
      // 如果魔数不正确，说明没有文件系统镜像或是第一次使用
@@ -273,7 +279,9 @@ void iupdate(struct inode *ip) {
  *
  * 查找 inode 表 (itable)，看 (dev, inum) 是否已在内存中。
  * 如果在，增加引用计数并返回。
- * 如果不在，找一个空槽，初始化它 (ref=1, valid=0)，并返回。
+ * 如果不在，优先复用一个 ref==0 的表项；没有空闲表项时
+ * 从 slab 缓存分配新 inode，表随负载增长。
+ * 初始化它 (ref=1, valid=0)，并返回。
  * @param dev 设备号
  * @param inum inode 编号
  * @return 内存中的 inode 指针
@@ -283,7 +291,7 @@ struct inode* iget(uint dev, uint inum) {
 
      // 是否已经在表中缓存？
      empty = 0;
-     for(ip = &itable.inode[0]; ip < &itable.inode[50]; ip++){
+     for(ip = itable.head; ip; ip = ip->next){
           if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
                ip->ref++; // 增加引用计数
                return ip; // 命中缓存
@@ -292,9 +300,15 @@ struct inode* iget(uint dev, uint inum) {
                empty = ip;
      }
 
-     // 未命中缓存，回收空的 inode 表条目
-     if(empty == 0)
-          panic("iget: inode 表已满");
+     // 未命中缓存，回收空的 inode 表条目，没有则扩充表
+     if(empty == 0){
+          if((empty = kmem_cache_alloc(inode_cache)) == 0)
+               panic("iget: 内存不足");
+          empty->ref = 0;
+          empty->next = itable.head;
+          itable.head = empty;
+          itable.ninode++;
+     }
 
      ip = empty;
      ip->dev = dev;
@@ -513,9 +527,7 @@ int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
           m = min(n - tot, BSIZE - off%BSIZE);
              
           // 4. 复制数据 (简化版本：假设 user_dst==0，直接复制到内核地址)
-          for(uint i = 0; i < m; i++){
-               ((char*)dst)[i] = bp->data[off%BSIZE + i];
-          }
+          memmove((char*)dst, bp->data + off%BSIZE, m);
              
           brelse(bp);
      }
@@ -542,6 +554,9 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
      if(off + n > MAXFILE*BSIZE) // 检查是否超过最大文件大小
           return -1;
 
+     // 正在运行的程序继续使用缓存中的旧页，之后的exec重新读入
+     text_invalidate(ip);
+
      for(tot=0; tot<n; tot+=m, off+=m, src+=m){
           // 1. 获取物理块号 (如果不存在，bmap 会自动分配)
           uint addr = bmap(ip, off/BSIZE);
@@ -557,14 +572,15 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
           m = min(n - tot, BSIZE - off%BSIZE);
              
           // 4. 复制数据 (简化版本：假设 user_src==0，直接从内核地址复制)
-          for(uint i = 0; i < m; i++){
-               bp->data[off%BSIZE + i] = ((char*)src)[i];
-          }
+          memmove(bp->data + off%BSIZE, (char*)src, m);
              
           log_write(bp); // *日志操作*: 数据块已被修改，写入日志
           brelse(bp);
      }
 
+     // 共享映射看到写入的内容
+     text_write(ip, off - tot, src - tot, tot);
+
      // 5. 更新 inode 大小 (如果文件变大了)
      if(off > ip->size)
           ip->size = off;
@@ -77,6 +77,8 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  struct inode *next; // itable链表
 };
 
 // inode类型
@@ -61,10 +61,7 @@ static void install_trans(int recovering) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // 读日志块
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // 读目标块
     
-    // 复制数据
-    for(int i = 0; i < BSIZE; i++) {
-      dbuf->data[i] = lbuf->data[i];
-    }
+    memcpy(dbuf->data, lbuf->data, BSIZE);  // 复制数据
     
     bwrite(dbuf);  // 写到磁盘
     
@@ -160,10 +157,7 @@ static void write_log(void) {
     struct buf *to = bread(log.dev, log.start+tail+1); // 日志块
     struct buf *from = bread(log.dev, log.lh.block[tail]); // 缓存块
     
-    // 复制数据
-    for(int i = 0; i < BSIZE; i++) {
-      to->data[i] = from->data[i];
-    }
+    memcpy(to->data, from->data, BSIZE);  // 复制数据
     
     bwrite(to);  // 写到日志
     brelse(from);
@@ -2,6 +2,17 @@
 #include "type.h"
 #include "utils/console.h"
 #include "proc/proc.h"
+#include "boot/fdt.h"
+#include "mm/memlayout.h"
+#include "mm/page.h"
+#include "mm/swap.h"
+#include "mm/mmap.h"
+#include "proc/elf.h"
+#include "fs/fs.h"
+#include "fs/bio.h"
+#include "fs/file.h"
+#include "fs/syscall_fs.h"
+#include "syscall/syscall.h"
 
 /* RISC-V操作系统主函数 - 扩展实验: 优先级调度 */
 
@@ -9,6 +20,13 @@
 void test_priority_scheduling(void);
 void test_aging_mechanism(void);
 void test_same_priority(void);
+void test_lazy_cow(void);
+void test_memops_bandwidth(void);
+void test_smp_scaling(void);
+void test_load_balance(void);
+void test_fair_share(void);
+void test_exec_textcache(void);
+void test_shared_mmap(void);
 
 // 测试任务函数声明
 void high_priority_task(void);
@@ -18,19 +36,48 @@ void equal_priority_task_1(void);
 void equal_priority_task_2(void);
 void aging_test_task_high(void);
 void aging_test_task_low(void);
+void vm_test_task(void);
+void vm_test_child(void);
+void smp_worker_task(void);
+void share_task(void);
+void exec_test_task(void);
+void exec_test_child(void);
+void shm_test_task(void);
+void shm_test_peer(void);
+void shm_test_child(void);
+
+// CPU 0完成初始化后置1，其他CPU等待它
+static volatile int started = 0;
 
 void main(void) {
+  if(cpuid() != 0) {
+    while(started == 0)
+      ;
+    __sync_synchronize();
+    printf("hart %d starting\n", cpuid());
+    kvminithart();    // 打开分页
+    trapinithart();   // 设置陷阱向量
+    scheduler();
+  }
+
+  printfinit();
   printf("====================================\n");
   printf("   RISC-V OS - Priority Scheduler\n");
   printf("====================================\n\n");
 
   // 初始化各个子系统
+  // 设备树可能位于内存末尾，必须在物理内存分配器接管之前解析
+  printf("Parsing device tree...\n");
+  fdt_init(dtb_pa);
+  fdt_print();
+
   printf("Initializing memory management...\n");
   kinit();
   
   printf("Initializing virtual memory...\n");
   kvminit();
   kvminithart();
+  vmalloc_init();
   
   printf("Initializing trap handling...\n");
   trapinithart();
@@ -38,6 +85,12 @@ void main(void) {
   printf("Initializing process management...\n");
   procinit();
 
+  printf("Starting page reclaim daemon...\n");
+  reclaim_init();
+  textcache_init();
+  swapinit();
+  ksm_init();
+
   printf("\n=== System Initialization Complete ===\n\n");
 
   // 选择测试场景
@@ -45,6 +98,13 @@ void main(void) {
   printf("1. Priority Scheduling Test (Different Priorities)\n");
   printf("2. Aging Mechanism Test\n");
   printf("3. Same Priority Test (Round Robin)\n");
+  printf("4. Lazy sbrk + Copy-on-write Fork Test\n");
+  printf("5. Memory Primitive Bandwidth\n");
+  printf("6. SMP Scaling (CPU-bound, compare make run CPUS=1 and CPUS=4)\n");
+  printf("7. Load Balancing (mixed priorities, make run CPUS=4)\n");
+  printf("8. Weighted Fair Share (make run SCHED=fair)\n");
+  printf("9. exec + Text Cache (in-memory file system)\n");
+  printf("10. Shared File Mappings (two mappers + fork)\n");
   printf("\n");
 
   // 测试1: 不同优先级测试
@@ -56,12 +116,38 @@ void main(void) {
   // 测试3: 相同优先级测试
   test_same_priority();
 
+  // 测试4: 按需分配堆与写时复制fork
+  // test_lazy_cow();
+
+  // 测试5: 内存操作函数带宽
+  // test_memops_bandwidth();
+
+  // 测试6: 多核扩展性
+  // test_smp_scaling();
+
+  // 测试7: 多核负载均衡
+  // test_load_balance();
+
+  // 测试8: 按优先级加权的CPU时间分配
+  // test_fair_share();
+
+  // 测试9: exec按需装入与文本缓存
+  // test_exec_textcache();
+
+  // 测试10: 多个进程共享映射同一文件
+  // test_shared_mmap();
+
   printf("\n=== All Test Processes Created ===\n\n");
 
-  // 打印初始进程表
+  // 打印初始进程表和内存占用
   debug_proc_table();
+  debug_mem_table();
+
+  printf("Starting scheduler on %d CPU(s)...\n\n", machine.ncpu);
 
-  printf("Starting scheduler...\n\n");
+  // 其他CPU开始运行各自的调度器
+  __sync_synchronize();
+  started = 1;
   
   // 进入调度器（不返回）
   scheduler();
@@ -98,7 +184,7 @@ void test_aging_mechanism(void) {
   
   // 创建一个低优先级任务（等待被aging提升）
   int pid_low = create_process(aging_test_task_low, "starving", 1);
-  printf("Created: PID=%d, Name=starving, Priority=1 (should be boosted)\n", pid_low);
+  printf("Created: PID=%d, Name=starving, Priority=1 (boosted while it waits)\n", pid_low);
   
   printf("Expected: starving process should eventually get CPU time via aging\n\n");
 }
@@ -116,6 +202,230 @@ void test_same_priority(void) {
   printf("Expected: Both processes should alternate execution\n\n");
 }
 
+// 测试4: 按需分配堆与写时复制fork
+void test_lazy_cow(void) {
+  printf("--- Test 4: Lazy sbrk + Copy-on-write Fork ---\n");
+
+  int pid = create_process(vm_test_task, "vm_test", 5);
+  printf("Created: PID=%d, Name=vm_test, Priority=5\n", pid);
+
+  printf("Expected: only touched heap pages are resident; the child sees the\n");
+  printf("parent's data, and writes after fork copy just the written page\n\n");
+}
+
+// 测试5: 内存操作函数带宽，按块大小报告每周期处理的字节数
+#define MEMOPS_ORDER 4                       // 测试缓冲区为 2^4 页
+#define MEMOPS_BYTES (128 * 1024)            // 每项测试处理的总字节数
+
+// 逐字节复制，作为对照
+static void bytecopy(volatile char *d, const char *s, uint n) {
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+static void memops_report(char *name, uint size, uint64 cycles) {
+  uint64 x100 = cycles ? MEMOPS_BYTES * 100 / cycles : 0;
+  printf("  %s %d B: %d.%d%d B/cycle\n", name, size,
+         (int)(x100 / 100), (int)(x100 / 10 % 10), (int)(x100 % 10));
+}
+
+void test_memops_bandwidth(void) {
+  static uint sizes[] = { 64, 1024, 4096, 32768 };
+  char *a = kalloc_pages(MEMOPS_ORDER);
+  char *b = kalloc_pages(MEMOPS_ORDER);
+  volatile int sink = 0;
+
+  printf("--- Test 5: Memory Primitive Bandwidth ---\n");
+  if(a == 0 || b == 0)
+    panic("test_memops_bandwidth");
+  memset(a, 0x5a, PGSIZE << MEMOPS_ORDER);
+  memset(b, 0x5a, PGSIZE << MEMOPS_ORDER);
+
+  for(int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+    uint n = sizes[i];
+    int reps = MEMOPS_BYTES / n;
+    uint64 t;
+
+    t = r_cycle();
+    for(int r = 0; r < reps; r++)
+      bytecopy(b, a, n);
+    memops_report("bytecopy", n, r_cycle() - t);
+
+    t = r_cycle();
+    for(int r = 0; r < reps; r++)
+      memset(b, r, n);
+    memops_report("memset  ", n, r_cycle() - t);
+
+    t = r_cycle();
+    for(int r = 0; r < reps; r++)
+      memcpy(b, a, n);
+    memops_report("memcpy  ", n, r_cycle() - t);
+
+    // 重叠的移动，目的在源之后，走反向复制路径
+    t = r_cycle();
+    for(int r = 0; r < reps; r++)
+      memmove(a + 64, a, n);
+    memops_report("memmove ", n, r_cycle() - t);
+
+    memcpy(b, a, n);
+    t = r_cycle();
+    for(int r = 0; r < reps; r++)
+      sink += memcmp(a, b, n);
+    memops_report("memcmp  ", n, r_cycle() - t);
+  }
+
+  kfree_pages(a, MEMOPS_ORDER);
+  kfree_pages(b, MEMOPS_ORDER);
+}
+
+// 测试6: 多核扩展性。SMP_TASKS个相同的CPU密集型任务，
+// 最后完成的任务报告总耗时，CPU数加倍时应接近减半
+#define SMP_TASKS 4
+#define SMP_WORK  20           // 每个任务的工作量（轮）
+
+static uint64 smp_start;
+static int smp_ntasks;
+static int smp_done;
+
+void test_smp_scaling(void) {
+  printf("--- Test 6: SMP Scaling ---\n");
+  smp_start = r_time();
+  smp_ntasks = SMP_TASKS;
+  smp_done = 0;
+  for(int i = 0; i < SMP_TASKS; i++) {
+    int pid = create_process(smp_worker_task, "smp_worker", DEFAULT_PRIORITY);
+    printf("Created: PID=%d, Name=smp_worker, Priority=%d\n", pid, DEFAULT_PRIORITY);
+  }
+  printf("Expected: elapsed time shrinks as CPUs are added, up to %d CPUs\n\n",
+         SMP_TASKS);
+}
+
+// 测试7: 多核负载均衡。所有任务都在CPU 0上创建时就绪，优先级各不相同；
+// 结束时进程表下方的每CPU统计显示偷取和均衡迁移的次数及各队列的平均长度
+#define BALANCE_TASKS 8
+
+void test_load_balance(void) {
+  printf("--- Test 7: Load Balancing ---\n");
+  smp_start = r_time();
+  smp_ntasks = BALANCE_TASKS;
+  smp_done = 0;
+  for(int i = 0; i < BALANCE_TASKS; i++) {
+    int prio = 2 + (i % 3) * 3;
+    int pid = create_process(smp_worker_task, "balance", prio);
+    printf("Created: PID=%d, Name=balance, Priority=%d\n", pid, prio);
+  }
+  printf("Expected: idle CPUs steal work at once, queue lengths even out\n\n");
+}
+
+// 测试8: 加权公平调度。三个从不主动让出的CPU密集型任务运行同样长的时间，
+// 各自报告实际得到的CPU时间。SCHED=fair时三者之比接近权重之比
+// 526:1024:1991；默认的优先级调度下几乎全归优先级最高的任务
+#define SHARE_TASKS  3
+#define SHARE_WINDOW 20000000  // 每个任务运行的时长（time计数，2秒）
+
+void test_fair_share(void) {
+  printf("--- Test 8: Weighted Fair Share (sched=%s) ---\n", sched_name());
+  smp_start = r_time();
+  smp_ntasks = SHARE_TASKS;
+  smp_done = 0;
+  for(int i = 0; i < SHARE_TASKS; i++) {
+    int prio = 2 + i * 3;
+    int pid = create_process(share_task, "share", prio);
+    printf("Created: PID=%d, Name=share, Priority=%d\n", pid, prio);
+  }
+  printf("Expected (1 CPU, sched=fair): CPU time in proportion to the priority weights\n\n");
+}
+
+// 测试9、10使用的文件系统。块缓存没有接磁盘驱动，文件只存在于内存中
+static void test_fs_init(void) {
+  static int done = 0;
+
+  if(done)
+    return;
+  done = 1;
+  binit();
+  fileinit();
+  fsinit(1);
+}
+
+// 测试9: exec与文本缓存。把内核映像中的一个小程序写入文件系统后exec三次：
+// 第二次的代码页来自缓存，不读文件；第三次之前改写文件，缓存项作废，
+// 重新读入的是新内容
+#define EXEC_TEST_PATH "/hello"
+
+// 页对齐的ELF程序：第0页是文件头和段头，第1页是装入到USERBASE的代码段。
+// 代码是 addi a0, a0, 40; ret，从入口返回时exec_enter()以argc+40调用exit()
+static const struct {
+  struct elfhdr elf;
+  struct proghdr ph;
+  uchar pad[PGSIZE - sizeof(struct elfhdr) - sizeof(struct proghdr)];
+  uint code[PGSIZE / sizeof(uint)];
+} hello_elf = {
+  .elf = {
+    .magic = ELF_MAGIC,
+    .elf = { 2, 1, 1 },          // 64位，小端，版本1
+    .type = 2,                   // ET_EXEC
+    .machine = 0xf3,             // EM_RISCV
+    .version = 1,
+    .entry = USERBASE,
+    .phoff = sizeof(struct elfhdr),
+    .ehsize = sizeof(struct elfhdr),
+    .phentsize = sizeof(struct proghdr),
+    .phnum = 1,
+  },
+  .ph = {
+    .type = ELF_PROG_LOAD,
+    .flags = ELF_PROG_FLAG_READ | ELF_PROG_FLAG_EXEC,
+    .off = PGSIZE,
+    .vaddr = USERBASE,
+    .paddr = USERBASE,
+    .filesz = PGSIZE,
+    .memsz = PGSIZE,
+    .align = PGSIZE,
+  },
+  .code = { 0x02850513, 0x00008067 },
+};
+
+// 改写后的代码：addi a0, a0, 50; ret
+static const uint hello_code2[] = { 0x03250513, 0x00008067 };
+
+void test_exec_textcache(void) {
+  printf("--- Test 9: exec + Text Cache ---\n");
+  test_fs_init();
+
+  int pid = create_process(exec_test_task, "exec_test", 5);
+  printf("Created: PID=%d, Name=exec_test, Priority=5\n", pid);
+
+  printf("Expected: run 1 reads the code page (miss), run 2 maps the cached page\n");
+  printf("(hit, no file read), run 3 after the rewrite misses and returns 52\n\n");
+}
+
+// 测试10: 共享文件映射。两个互不相关的进程各自以MAP_SHARED映射同一文件，
+// 再加上其中一个fork出的子进程，三者映射同一物理页、互相看到对方的写入，
+// 也看到write()写入文件的内容；一方munmap写回时不覆盖另一方的写入
+#define SHM_TEST_PATH "/shared"
+#define SHM_TEST_INIT "................"    // 文件的初始内容
+#define SHM_TEST_WANT "ABaCb...........W"   // 所有写入之后文件的内容
+
+static volatile int shm_step;   // 两个进程轮流推进的步骤
+static char *shm_map;           // shm_test_task的映射地址，fork的子进程沿用
+static uint64 shm_pa[2];        // 两个进程的映射所在的物理页
+
+void test_shared_mmap(void) {
+  printf("--- Test 10: Shared File Mappings ---\n");
+  test_fs_init();
+  shm_step = 0;
+
+  int pid = create_process(shm_test_task, "shm_test", 5);
+  printf("Created: PID=%d, Name=shm_test, Priority=5\n", pid);
+  pid = create_process(shm_test_peer, "shm_peer", 5);
+  printf("Created: PID=%d, Name=shm_peer, Priority=5\n", pid);
+
+  printf("Expected: both mappers share one physical page and see each other's\n");
+  printf("writes, write() and the forked child's write; the file ends as %s\n\n",
+         SHM_TEST_WANT);
+}
+
 // ========== 任务函数实现 ==========
 
 // 高优先级任务
@@ -205,6 +515,36 @@ void equal_priority_task_2(void) {
   exit(0);
 }
 
+// 多核扩展性测试任务
+void smp_worker_task(void) {
+  struct proc *p = myproc();
+
+  for(int i = 0; i < SMP_WORK; i++) {
+    for(volatile int j = 0; j < 10000000; j++);
+    yield();
+  }
+  printf("[SMP] Process %d done on CPU %d\n", p->pid, p->cpu);
+  if(__sync_add_and_fetch(&smp_done, 1) == smp_ntasks) {
+    printf("[SMP] %d tasks finished in %d ms on %d CPU(s)\n", smp_ntasks,
+           (int)((r_time() - smp_start) / 10000), machine.ncpu);
+    debug_proc_table();
+  }
+  exit(0);
+}
+
+// 加权公平测试任务：只靠时钟中断被抢占
+void share_task(void) {
+  struct proc *p = myproc();
+
+  while(r_time() - smp_start < SHARE_WINDOW)
+    ;
+  printf("[SHARE] Process %d (Priority=%d) got %d ms CPU\n",
+         p->pid, p->priority, (int)(p->sum_exec / 10000));
+  if(__sync_add_and_fetch(&smp_done, 1) == smp_ntasks)
+    debug_proc_table();
+  exit(0);
+}
+
 // Aging测试 - CPU密集型任务
 void aging_test_task_high(void) {
   struct proc *p = myproc();
@@ -228,8 +568,8 @@ void aging_test_task_low(void) {
   printf("[STARVING] Process %d started (Priority=%d)\n", p->pid, p->priority);
   
   for(int i = 0; i < 5; i++) {
-    printf("[STARVING] Finally running! Iteration %d/5 (Current Priority=%d)\n", 
-           i+1, p->priority);
+    printf("[STARVING] Finally running! Iteration %d/5 (Priority=%d, waited %d slices)\n", 
+           i+1, p->priority, p->wait_time);
     for(volatile int j = 0; j < 3000000; j++);
     yield();
   }
@@ -237,4 +577,207 @@ void aging_test_task_low(void) {
   printf("[STARVING] Process %d completed (Final Priority=%d)\n", 
          p->pid, p->priority);
   exit(0);
-}
\ No newline at end of file
+}
+// 通过ecall发起一个单参数的系统调用
+static uint64 do_syscall(int num, uint64 arg) {
+  register uint64 a0 asm("a0") = arg;
+  register uint64 a7 asm("a7") = num;
+  asm volatile("ecall" : "+r"(a0) : "r"(a7) : "memory");
+  return a0;
+}
+
+#define VM_TEST_PAGES 256
+
+// 按需分配/写时复制测试 - 父进程
+void vm_test_task(void) {
+  struct proc *p = myproc();
+  char *heap = (char*)do_syscall(SYS_SBRK, VM_TEST_PAGES * PGSIZE);
+
+  printf("[VM_TEST] sbrk(%d pages) -> 0x%x, RSS=%d\n",
+         VM_TEST_PAGES, (int)(uint64)heap, (int)p->rss);
+
+  // 只访问其中4页
+  for(int i = 0; i < 4; i++)
+    heap[i * 64 * PGSIZE] = 'A' + i;
+  printf("[VM_TEST] touched 4 pages: RSS=%d, demand-zero faults=%d\n",
+         (int)p->rss, (int)p->minflt);
+
+  struct memstat st;
+  do_syscall(SYS_MEMSTAT, (uint64)&st);
+  printf("[VM_TEST] memstat: used=%d free=%d, user-anon=%d (peak %d)\n",
+         (int)st.used, (int)st.free, (int)st.live[PGO_ANON], (int)st.peak[PGO_ANON]);
+
+  int pid = do_syscall(SYS_FORK, (uint64)vm_test_child);
+  printf("[VM_TEST] forked child %d\n", pid);
+
+  heap[0] = 'P';
+  printf("[VM_TEST] parent wrote page 0: COW faults=%d, heap[0]=%c\n",
+         (int)p->cowflt, heap[0]);
+
+  do_syscall(SYS_WAIT, 0);
+  printf("[VM_TEST] Process %d completed\n", p->pid);
+  exit(0);
+}
+
+// 按需分配/写时复制测试 - 子进程
+void vm_test_child(void) {
+  struct proc *p = myproc();
+  char *heap = (char*)USERBASE;
+
+  printf("[VM_CHILD] inherited heap[0]=%c heap[64 pages]=%c, RSS=%d\n",
+         heap[0], heap[64 * PGSIZE], (int)p->rss);
+  heap[64 * PGSIZE] = 'C';
+  printf("[VM_CHILD] wrote one page: COW faults=%d\n", (int)p->cowflt);
+  exit(0);
+}
+
+// exec测试 - 父进程：写入程序，每次fork一个子进程exec它并检查结果
+void exec_test_task(void) {
+  static const struct { int status, hits, misses; } want[3] = {
+    { 42, 0, 1 },     // 第一次exec：读入代码页
+    { 42, 1, 0 },     // 第二次：代码页来自缓存，不读文件
+    { 52, 0, 1 },     // 文件被改写后：缓存项作废，读入新内容
+  };
+  uint64 h0, m0, hits, misses;
+  int fd, nfile, status, ok = 1;
+
+  if((fd = open(EXEC_TEST_PATH, O_CREATE | O_RDWR)) < 0 ||
+     write(fd, &hello_elf, sizeof(hello_elf)) != sizeof(hello_elf))
+    panic("exec_test_task: write");
+  close(fd);
+  nfile = ftable.nfile;
+
+  for(int i = 0; i < 3; i++) {
+    if(i == 2) {
+      // 改写代码页，writei()使文本缓存项作废
+      fd = open(EXEC_TEST_PATH, O_RDWR);
+      write(fd, &hello_elf, PGSIZE);
+      write(fd, hello_code2, sizeof(hello_code2));
+      close(fd);
+    }
+    textcache_counts(&h0, &m0);
+    fork(exec_test_child);
+    wait(&status);
+    textcache_counts(&hits, &misses);
+
+    int good = status == want[i].status && hits - h0 == want[i].hits &&
+               misses - m0 == want[i].misses;
+    printf("[EXEC] run %d: exit status %d, text cache hits +%d misses +%d %s\n",
+           i + 1, status, (int)(hits - h0), (int)(misses - m0), good ? "ok" : "FAILED");
+    ok &= good;
+  }
+
+  // exec持有的文件引用都已随子进程释放
+  printf("[EXEC] open files: %d before, %d after %s\n", nfile, ftable.nfile,
+         nfile == ftable.nfile ? "ok" : "FAILED");
+  ok &= nfile == ftable.nfile;
+  textcache_stats();
+  printf("[EXEC] %s\n", ok ? "passed" : "FAILED");
+  exit(0);
+}
+
+// exec测试 - 子进程：以2个参数运行程序，程序返回argc+40
+void exec_test_child(void) {
+  char *argv[] = { "hello", "x", 0 };
+
+  exec(EXEC_TEST_PATH, argv);
+  printf("[EXEC] exec %s failed\n", EXEC_TEST_PATH);
+  exit(-1);
+}
+
+// 等待另一个进程推进到步骤step
+static void shm_wait(int step) {
+  while(shm_step < step)
+    yield();
+}
+
+// 读出文件path的前n字节并与want比较，相同返回1
+static int shm_check_file(char *path, char *want, int n) {
+  char buf[32];
+  int fd = open(path, O_RDONLY);
+  int got = read(fd, buf, n);
+
+  close(fd);
+  return got == n && memcmp(buf, want, n) == 0;
+}
+
+static void shm_report(char *what, int good, int *ok) {
+  printf("[SHM] %s: %s\n", what, good ? "ok" : "FAILED");
+  *ok &= good;
+}
+
+// 共享映射测试 - 第一个映射者
+void shm_test_task(void) {
+  struct proc *p = myproc();
+  int fd, status, ok = 1;
+  int n = sizeof(SHM_TEST_WANT) - 1;
+
+  if((fd = open(SHM_TEST_PATH, O_CREATE | O_RDWR)) < 0 ||
+     write(fd, SHM_TEST_INIT, sizeof(SHM_TEST_INIT) - 1) != sizeof(SHM_TEST_INIT) - 1)
+    panic("shm_test_task: write");
+  shm_map = (char*)mmap(PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(shm_map == (char*)-1)
+    panic("shm_test_task: mmap");
+  shm_map[0] = 'A';
+  shm_pa[0] = walkaddr(p->pagetable, (uint64)shm_map);
+  shm_step = 1;
+
+  // 对方映射后写入了第1字节
+  shm_wait(2);
+  shm_report("same physical page", shm_pa[0] != 0 && shm_pa[0] == shm_pa[1], &ok);
+  shm_report("peer's write visible", shm_map[1] == 'B', &ok);
+  shm_map[2] = 'a';
+
+  // write()追加到文件末尾，映射中立即可见
+  write(fd, "W", 1);
+  shm_report("write() visible", shm_map[16] == 'W', &ok);
+
+  // fork出的子进程继承映射，写入第3字节
+  fork(shm_test_child);
+  wait(&status);
+  shm_report("child's write visible", shm_map[3] == 'C', &ok);
+  shm_step = 3;
+
+  // 对方写入第4字节后munmap，写回的页包含这里写入的第2字节
+  shm_wait(4);
+  shm_report("peer's munmap kept our write", shm_check_file(SHM_TEST_PATH, SHM_TEST_WANT, n), &ok);
+  munmap((uint64)shm_map, PGSIZE);
+  close(fd);
+  shm_report("file after our munmap", shm_check_file(SHM_TEST_PATH, SHM_TEST_WANT, n), &ok);
+  textcache_stats();
+  printf("[SHM] %s\n", ok ? "passed" : "FAILED");
+  exit(0);
+}
+
+// 共享映射测试 - 另一个独立打开并映射同一文件的进程
+void shm_test_peer(void) {
+  struct proc *p = myproc();
+  char *m;
+  int fd;
+
+  shm_wait(1);
+  if((fd = open(SHM_TEST_PATH, O_RDWR)) < 0)
+    panic("shm_test_peer: open");
+  m = (char*)mmap(PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(m == (char*)-1)
+    panic("shm_test_peer: mmap");
+  printf("[SHM] peer sees first write: %s\n", m[0] == 'A' ? "ok" : "FAILED");
+  m[1] = 'B';
+  shm_pa[1] = walkaddr(p->pagetable, (uint64)m);
+  shm_step = 2;
+
+  shm_wait(3);
+  printf("[SHM] peer sees write() and child's write: %s\n",
+         m[16] == 'W' && m[3] == 'C' ? "ok" : "FAILED");
+  m[4] = 'b';
+  munmap((uint64)m, PGSIZE);
+  close(fd);
+  shm_step = 4;
+  exit(0);
+}
+
+// 共享映射测试 - fork出的子进程，通过继承的映射写入
+void shm_test_child(void) {
+  shm_map[3] = 'C';
+  exit(0);
+}
@@ -0,0 +1,341 @@
+// 二进制伙伴系统物理页分配器
+//
+// 空闲内存按 2^k 页的块组织，每阶一个双向空闲链表。
+// 分配时从不小于所需阶的最小非空链表取块，逐级对半拆分；
+// 释放时检查伙伴块（页号异或 2^k）是否空闲且同阶，是则合并，
+// 直到无法继续合并。块的页号相对KERNBASE计算，因此 2^k 页的块
+// 在物理地址上也按 2^k 页对齐，可直接用于大页映射和DMA缓冲区。
+//
+// 单页分配走kalloc.c中的每CPU缓存，只有批量补充/归还时才进入这里。
+//
+// 延迟初始化：启动时只记录一个待初始化区间 [deferred, nlimit)，
+// 不触碰这部分内存及其页描述符。当空闲链表无法满足分配时，
+// 或调度器空闲时，每次把一个最大阶大小的片段(DEFER_CHUNK页)
+// 初始化并放入空闲链表。这样启动时间与内存大小无关。
+
+#include "../type.h"
+#include "../def.h"
+#include "memlayout.h"
+#include "page.h"
+#include "../proc/spinlock.h"
+
+struct page *pages;   // 页描述符数组，覆盖 [KERNBASE, PHYSTOP)
+uint64 npages;
+
+struct {
+  struct spinlock lock;
+  struct page *free[MAX_ORDER];   // 每阶空闲链表
+  uint64 nr_free[MAX_ORDER];      // 每阶空闲块数
+  uint64 free_pages;              // 空闲页总数
+  uint64 managed_pages;           // 伙伴系统管理的页总数
+  uint64 deferred;                // 第一个尚未初始化的页号，其前的描述符均有效
+  uint64 nlimit;                  // 可分配内存的结束页号
+  uint64 deferred_grows;          // 按需初始化片段的次数
+  uint64 splits;                  // 拆分次数
+  uint64 merges;                  // 合并次数
+  uint64 failed[MAX_ORDER];       // 各阶分配失败次数
+} buddy;
+
+static void
+free_list_add(struct page *pg, int order)
+{
+  pg->flags = PG_BUDDY;
+  pg->order = order;
+  pg->prev = 0;
+  pg->next = buddy.free[order];
+  if(pg->next)
+    pg->next->prev = pg;
+  buddy.free[order] = pg;
+  buddy.nr_free[order]++;
+}
+
+static void
+free_list_del(struct page *pg, int order)
+{
+  if(pg->prev)
+    pg->prev->next = pg->next;
+  else
+    buddy.free[order] = pg->next;
+  if(pg->next)
+    pg->next->prev = pg->prev;
+  pg->next = pg->prev = 0;
+  pg->flags = 0;
+  buddy.nr_free[order]--;
+}
+
+static void __buddy_free(struct page *pg, int order);
+static int  deferred_grow(void);
+
+// 分配一个 2^order 页的块，调用者持有buddy.lock
+static struct page*
+__buddy_alloc(int order)
+{
+  struct page *pg;
+  int o;
+
+  for(;;){
+    for(o = order; o < MAX_ORDER; o++)
+      if(buddy.free[o])
+        break;
+    if(o < MAX_ORDER)
+      break;
+    // 空闲链表不足，初始化下一个延迟片段后重试
+    if(deferred_grow() == 0){
+      buddy.failed[order]++;
+      return 0;
+    }
+  }
+
+  pg = buddy.free[o];
+  free_list_del(pg, o);
+
+  // 把多余的后半部分逐级放回低阶链表
+  while(o > order){
+    o--;
+    free_list_add(pg + (1L << o), o);
+    buddy.splits++;
+  }
+
+  pg->flags = PG_HEAD;
+  pg->order = order;
+  buddy.free_pages -= 1L << order;
+  return pg;
+}
+
+// 释放一个 2^order 页的块并尽可能与伙伴合并，调用者持有buddy.lock
+static void
+__buddy_free(struct page *pg, int order)
+{
+  uint64 idx = pg - pages;
+
+  pg->flags = 0;
+  buddy.free_pages += 1L << order;
+
+  while(order < MAX_ORDER - 1){
+    uint64 bidx = idx ^ (1L << order);
+    struct page *b;
+
+    if(bidx >= buddy.deferred)  // 伙伴尚未初始化
+      break;
+    b = &pages[bidx];
+    if((b->flags & PG_BUDDY) == 0 || b->order != order)
+      break;
+    free_list_del(b, order);
+    buddy.merges++;
+    idx &= ~(1L << order);
+    order++;
+  }
+  free_list_add(&pages[idx], order);
+}
+
+// 把页号区间 [idx, last) 交给伙伴系统。
+// 每次放入地址对齐允许的最大块，而不是逐页释放。
+static void
+buddy_free_range(uint64 idx, uint64 last)
+{
+  while(idx < last){
+    int order = MAX_ORDER - 1;
+    while((idx & ((1L << order) - 1)) != 0 || idx + (1L << order) > last)
+      order--;
+    buddy.managed_pages += 1L << order;
+    __buddy_free(&pages[idx], order);
+    idx += 1L << order;
+  }
+}
+
+#define DEFER_CHUNK (1L << (MAX_ORDER - 1))  // 每次初始化的页数
+
+// 初始化下一个延迟片段（到下一个DEFER_CHUNK边界为止）并放入空闲链表，
+// 返回新增的页数，没有剩余内存时返回0。调用者持有buddy.lock
+static int
+deferred_grow(void)
+{
+  uint64 idx = buddy.deferred;
+  uint64 last;
+
+  if(idx >= buddy.nlimit)
+    return 0;
+  last = (idx + DEFER_CHUNK) & ~(DEFER_CHUNK - 1);
+  if(last > buddy.nlimit)
+    last = buddy.nlimit;
+
+  memset(&pages[idx], 0, (last - idx) * sizeof(struct page));
+  buddy.deferred = last;
+  buddy_free_range(idx, last);
+  buddy.deferred_grows++;
+  return last - idx;
+}
+
+// 在后台把最多nchunk个延迟片段放入空闲链表，返回新增的页数。
+// 由调度器空闲时调用，逐片段加锁，避免长时间持锁。
+int
+buddy_grow_deferred(int nchunk)
+{
+  int n = 0;
+
+  for(int i = 0; i < nchunk; i++){
+    acquire(&buddy.lock);
+    int got = deferred_grow();
+    release(&buddy.lock);
+    if(got == 0)
+      break;
+    n += got;
+  }
+  return n;
+}
+
+// 在内核镜像之后放置页描述符数组，其余内存登记为延迟初始化区间。
+// 这里只初始化保留页的描述符，不触碰可分配内存本身。
+void
+buddy_init(void *pa_start, void *pa_end)
+{
+  uint64 start;
+
+  initlock(&buddy.lock, "buddy");
+
+  npages = ((uint64)pa_end - KERNBASE) >> PGSHIFT;
+  pages = (struct page*)PGROUNDUP((uint64)pa_start);
+  start = PGROUNDUP((uint64)(pages + npages));
+
+  buddy.deferred = (start - KERNBASE) >> PGSHIFT;
+  buddy.nlimit = npages;
+  for(uint64 i = 0; i < buddy.deferred; i++){
+    pages[i].flags = PG_RESERVED;
+    pages[i].order = 0;
+    pages[i].next = pages[i].prev = 0;
+  }
+}
+
+// 分配 2^order 个物理上连续的页，返回首页物理地址，失败返回0
+void*
+kalloc_pages(int order)
+{
+  struct page *pg;
+
+  if(order < 0 || order >= MAX_ORDER)
+    return 0;
+
+  acquire(&buddy.lock);
+  pg = __buddy_alloc(order);
+  release(&buddy.lock);
+
+  if(pg == 0)
+    return 0;
+  page_owner(pg, PGO_KERNEL);
+#ifdef KALLOC_DEBUG
+  memset((void*)page2pa(pg), 5, PGSIZE << order); // fill with junk
+#endif
+  return (void*)page2pa(pg);
+}
+
+// 释放kalloc_pages()分配的块，order必须与分配时一致
+void
+kfree_pages(void *pa, int order)
+{
+  struct page *pg;
+
+  if(order < 0 || order >= MAX_ORDER ||
+     ((uint64)pa & ((PGSIZE << order) - 1)) != 0 ||
+     (uint64)pa < KERNBASE || (uint64)pa >= PHYSTOP)
+    panic("kfree_pages");
+
+  pg = pa2page(pa);
+  if((pg->flags & PG_HEAD) == 0 || pg->order != order)
+    panic("kfree_pages: bad block");
+  page_owner(pg, PGO_FREE);
+
+#ifdef KALLOC_DEBUG
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&buddy.lock);
+  __buddy_free(pg, order);
+  release(&buddy.lock);
+}
+
+// 一次加锁取出最多n个单页，供每CPU缓存批量补充，返回实际取得的页数
+int
+buddy_alloc_batch(void **pa, int n)
+{
+  struct page *pg;
+  int i;
+
+  acquire(&buddy.lock);
+  for(i = 0; i < n; i++){
+    if((pg = __buddy_alloc(0)) == 0)
+      break;
+    pa[i] = (void*)page2pa(pg);
+  }
+  release(&buddy.lock);
+  return i;
+}
+
+// 一次加锁归还n个单页
+void
+buddy_free_batch(void **pa, int n)
+{
+  acquire(&buddy.lock);
+  for(int i = 0; i < n; i++){
+    struct page *pg = pa2page(pa[i]);
+    if((pg->flags & PG_HEAD) == 0 || pg->order != 0)
+      panic("buddy_free_batch");
+    __buddy_free(pg, 0);
+  }
+  release(&buddy.lock);
+}
+
+// 空闲页数：空闲链表中的页加上尚未初始化的延迟区间。
+// 只用于水位判断，不加锁读取。
+uint64
+buddy_nr_free(void)
+{
+  return buddy.free_pages + (buddy.nlimit - buddy.deferred);
+}
+
+// 伙伴系统管理的页数，包括尚未初始化的延迟区间
+uint64
+buddy_nr_managed(void)
+{
+  return buddy.managed_pages + (buddy.nlimit - buddy.deferred);
+}
+
+// 打印伙伴系统碎片统计
+//
+// 对每一阶k给出不可用空闲空间指数：空闲内存中位于小于 2^k 页的块里、
+// 因而无法满足一次k阶分配的比例。0% 表示完全无碎片。
+void
+buddy_stats(void)
+{
+  uint64 nr_free[MAX_ORDER];
+  uint64 free, managed, splits, merges, deferred, grows;
+  int largest = -1;
+
+  acquire(&buddy.lock);
+  for(int o = 0; o < MAX_ORDER; o++)
+    nr_free[o] = buddy.nr_free[o];
+  free = buddy.free_pages;
+  managed = buddy.managed_pages;
+  splits = buddy.splits;
+  merges = buddy.merges;
+  deferred = buddy.nlimit - buddy.deferred;
+  grows = buddy.deferred_grows;
+  release(&buddy.lock);
+
+  printf("\n=== Buddy Allocator ===\n");
+  printf("managed=%d pages, free=%d pages, splits=%d, merges=%d\n",
+         (int)managed, (int)free, (int)splits, (int)merges);
+  printf("deferred (not yet initialized)=%d pages, chunks initialized=%d\n",
+         (int)deferred, (int)grows);
+  printf("Order\tBlock\tFree\tUnusable%%\n");
+  uint64 below = 0; // 阶数小于o的块中的空闲页
+  for(int o = 0; o < MAX_ORDER; o++){
+    if(nr_free[o])
+      largest = o;
+    printf("%d\t%dK\t%d\t%d\n", o, (PGSIZE << o) / 1024, (int)nr_free[o],
+           free ? (int)(below * 100 / free) : 0);
+    below += nr_free[o] << o;
+  }
+  printf("largest free block: order %d\n", largest);
+  printf("=======================\n\n");
+}
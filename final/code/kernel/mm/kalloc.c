@@ -1,12 +1,39 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// 两级结构：
+//   每CPU页缓存(kcache) -- 无锁，只需关中断
+//   伙伴系统(buddy.c)    -- 由自旋锁保护，负责连续多页分配与合并
+// kalloc()/kfree()优先操作本CPU的缓存，缓存为空时从伙伴系统
+// 批量补充KCACHE_BATCH页，超过KCACHE_HIGH时批量归还，
+// 从而把对全局锁的竞争降低到原来的1/KCACHE_BATCH。
+//
+// 另有一个预清零页池(zpool)，由调度器空闲时填充，
+// kalloc_zeroed()优先从中取页，避免在热路径上清零整页。
+// 页的垃圾填充(junk fill)只在 make KALLOC_DEBUG=1 时开启。
+//
+// 每个页的引用计数保存在页描述符中：kalloc()置为1，
+// 写时复制fork共享页时由kref_get()增加，kfree()递减到0才真正释放。
+//
+// 空闲页低于水位时由reclaim.c回收各种缓存，见reclaim_check()。
+//
+// 页的所有者类别(PGO_*)只通过page_owner()修改，它同时维护各类别
+// 当前的页数和峰值，用于debug_mem_table()和SYS_MEMSTAT。
 
 #include "../type.h"
 #include "memlayout.h"
 #include "../def.h"
+#include "page.h"
+#include "../proc/spinlock.h"
+#include "../proc/proc.h"
+#include "reclaim.h"
+#include "swap.h"
+#include "../utils/string.h"
 
-void freerange(void *pa_start, void *pa_end);
+#define KCACHE_BATCH 16              // 每次与伙伴系统交换的页数
+#define KCACHE_HIGH  (2*KCACHE_BATCH) // 每CPU缓存的页数上限
+#define ZPOOL_TARGET 64               // 预清零页池的目标页数
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
@@ -15,59 +42,418 @@ struct run {
   struct run *next;
 };
 
+// 每CPU页缓存
+struct kcache {
+  struct run *list;
+  int count;
+  uint64 alloc_hits;  // kalloc直接命中本地缓存
+  uint64 alloc_miss;  // kalloc需要访问伙伴系统
+  uint64 free_hits;   // kfree直接放入本地缓存
+  uint64 free_miss;   // kfree触发批量归还
+  uint64 empty;       // 补充时伙伴系统已无空闲页的次数
+} kcache[NCPU];
+
+// 各所有者类别的页数，PGO_FREE项不用（空闲页数由伙伴系统和页缓存给出）
+struct {
+  int live[NPGO];
+  int peak[NPGO];
+} pgacct;
+
+static char *pgo_names[NPGO] = {
+  [PGO_FREE]      "free",
+  [PGO_KERNEL]    "kernel",
+  [PGO_PAGETABLE] "pagetable",
+  [PGO_SLAB]      "slab",
+  [PGO_TRAPFRAME] "trapframe",
+  [PGO_BCACHE]    "bcache",
+  [PGO_KSTACK]    "kstack",
+  [PGO_ZPOOL]     "zeroed",
+  [PGO_ANON]      "user-anon",
+  [PGO_FILE]      "user-file",
+  [PGO_KSM]       "user-ksm",
+  [PGO_VMALLOC]   "vmalloc",
+};
+
+// 预清零页池，页首的链表指针在取出时清零
 struct {
-  struct run *freelist;
-} kmem;
+  struct spinlock lock;
+  struct run *list;
+  int count;
+  uint64 hits;        // kalloc_zeroed命中池
+  uint64 misses;      // 池为空，当场清零
+  uint64 zeroed;      // 空闲时累计清零的页数
+} zpool;
+
+static int kzero_shrink(int nr);
+static struct shrinker zpool_shrinker = { .name = "zpool", .scan = kzero_shrink };
 
 void
 kinit()
 {
-  freerange(end, (void*)PHYSTOP);
+  initlock(&zpool.lock, "zpool");
+  buddy_init(end, (void*)PHYSTOP);
+  register_shrinker(&zpool_shrinker);
+}
+
+// 从伙伴系统一次取最多KCACHE_BATCH页放入缓存c。
+// 调用时必须关中断。
+static void
+kcache_refill(struct kcache *c)
+{
+  void *batch[KCACHE_BATCH];
+  int n;
+
+  n = buddy_alloc_batch(batch, KCACHE_BATCH);
+  if(n == 0)
+    c->empty++;
+  for(int i = 0; i < n; i++){
+    struct run *r = (struct run*)batch[i];
+    r->next = c->list;
+    c->list = r;
+    c->count++;
+  }
 }
 
+// 把缓存c中的KCACHE_BATCH页一次归还给伙伴系统。
+// 调用时必须关中断。
+static void
+kcache_drain(struct kcache *c)
+{
+  void *batch[KCACHE_BATCH];
+  int n;
+
+  for(n = 0; n < KCACHE_BATCH && c->list; n++){
+    batch[n] = c->list;
+    c->list = c->list->next;
+    c->count--;
+  }
+  buddy_free_batch(batch, n);
+}
+
+// 一次释放n个单页（pa数组会被改写）：递减各页的引用计数，
+// 最后一个引用释放的页一次加锁从LRU摘下、一次加锁归还伙伴系统，
+// 不经过每CPU页缓存。用于释放进程地址空间等一次释放大量页的场合。
 void
-freerange(void *pa_start, void *pa_end)
+kfree_batch(void **pa, int n)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  int nfree = 0;
+
+  for(int i = 0; i < n; i++){
+    struct page *pg;
+    if(((uint64)pa[i] % PGSIZE) != 0 || (char*)pa[i] < end || (uint64)pa[i] >= PHYSTOP)
+      panic("kfree_batch");
+    pg = pa2page(pa[i]);
+    if(pg->order != 0)
+      panic("kfree_batch: multi-page block");
+    if(pg->refcnt > 1 && __sync_sub_and_fetch(&pg->refcnt, 1) > 0)
+      continue;
+    pg->refcnt = 0;
+    pa[nfree++] = pa[i];
+  }
+  if(nfree == 0)
+    return;
+
+  lru_del_batch(pa, nfree);
+  for(int i = 0; i < nfree; i++){
+    page_owner(pa2page(pa[i]), PGO_FREE);
+#ifdef KALLOC_DEBUG
+    memset(pa[i], 1, PGSIZE);
+#endif
+  }
+  buddy_free_batch(pa, nfree);
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kcache *c;
+  struct page *pg;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
+  pg = pa2page(pa);
+  if(pg->order != 0)
+    panic("kfree: multi-page block, use kfree_pages");
+
+  // 写时复制共享的页只递减引用计数，最后一个引用释放时才回收
+  if(pg->refcnt > 1 && __sync_sub_and_fetch(&pg->refcnt, 1) > 0)
+    return;
+  pg->refcnt = 0;
+  if(pg->flags & PG_LRU)
+    lru_del(pa);
+  page_owner(pg, PGO_FREE);
 
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  push_off();
+  c = &kcache[cpuid()];
+  r->next = c->list;
+  c->list = r;
+  c->count++;
+  if(c->count > KCACHE_HIGH){
+    c->free_miss++;
+    kcache_drain(c);
+  } else {
+    c->free_hits++;
+  }
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// 补充本地缓存时检查水位，必要时唤醒kreclaimd；
+// 伙伴系统也没有空闲页时先同步回收一次再重试。
 void *
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
+  int miss, retried = 0;
 
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+again:
+  push_off();
+  c = &kcache[cpuid()];
+  miss = c->list == 0;
+  if(!miss){
+    c->alloc_hits++;
+  } else {
+    c->alloc_miss++;
+    kcache_refill(c);
+  }
+  r = c->list;
+  if(r){
+    c->list = r->next;
+    c->count--;
+  }
+  pop_off();
+
+  if(miss)
+    reclaim_check();
+  if(r == 0 && !retried){
+    retried = 1;
+    if(reclaim_direct() > 0)
+      goto again;
+  }
 
+  if(r){
+    pa2page(r)->refcnt = 1;
+    page_owner(pa2page(r), PGO_KERNEL);
+  }
+#ifdef KALLOC_DEBUG
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
+
+// 分配一个内容全为0的页，优先使用预清零页池。
+// 页表页等需要清零的调用者应使用它代替 kalloc()+memset()。
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  if((r = zpool.list) != 0){
+    zpool.list = r->next;
+    zpool.count--;
+    zpool.hits++;
+  } else {
+    zpool.misses++;
+  }
+  release(&zpool.lock);
+
+  if(r){
+    r->next = 0;  // 池中只有链表指针不为0
+    page_set_owner(r, PGO_KERNEL);
+    return (void*)r;
+  }
+
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// 增加一个对物理页pa的引用（fork共享写时复制页时使用）
+void
+kref_get(void *pa)
+{
+  struct page *pg = pa2page(pa);
+
+  if(pg->refcnt < 1)
+    panic("kref_get");
+  __sync_fetch_and_add(&pg->refcnt, 1);
+}
+
+// 物理页pa当前的引用数
+int
+kref_count(void *pa)
+{
+  return pa2page(pa)->refcnt;
+}
+
+// 把已分配块的首页pg改归owner类别，块的全部页随之转移
+void
+page_owner(struct page *pg, int owner)
+{
+  int old = pg->owner, n = 1 << pg->order, v;
+
+  if(old == owner)
+    return;
+  pg->owner = owner;
+  if(old != PGO_FREE)
+    __sync_fetch_and_sub(&pgacct.live[old], n);
+  if(owner != PGO_FREE){
+    v = __sync_add_and_fetch(&pgacct.live[owner], n);
+    if(v > pgacct.peak[owner])
+      pgacct.peak[owner] = v;    // 并发时峰值可能略偏低，统计用途可以接受
+  }
+}
+
+// 填写物理内存统计
+void
+kmem_getstat(struct memstat *st)
+{
+  uint64 cached = 0;
+
+  for(int i = 0; i < NCPU; i++)
+    cached += kcache[i].count;
+  st->total = buddy_nr_managed();
+  st->free = buddy_nr_free() + cached;
+  st->zeroed = pgacct.live[PGO_ZPOOL];
+  st->used = 0;
+  for(int i = 0; i < NPGO; i++){
+    st->live[i] = i == PGO_FREE ? 0 : pgacct.live[i];
+    st->peak[i] = i == PGO_FREE ? 0 : pgacct.peak[i];
+    if(i != PGO_FREE && i != PGO_ZPOOL)
+      st->used += st->live[i];
+  }
+}
+
+// 打印各所有者类别的页数和峰值
+void
+debug_mem_table(void)
+{
+  struct memstat st;
+
+  kmem_getstat(&st);
+  printf("\n=== Physical Memory ===\n");
+  printf("total=%d free=%d used=%d zeroed=%d pages\n",
+         (int)st.total, (int)st.free, (int)st.used, (int)st.zeroed);
+  printf("Owner\t\tPages\tPeak\tKB\n");
+  printf("------------------------------------\n");
+  for(int i = 0; i < NPGO; i++){
+    if(i == PGO_FREE)
+      continue;
+    printf("%s\t%s%d\t%d\t%d\n", pgo_names[i], strlen(pgo_names[i]) < 8 ? "\t" : "",
+           (int)st.live[i], (int)st.peak[i], (int)(st.live[i] * PGSIZE / 1024));
+  }
+  printf("====================================\n\n");
+}
+
+// 向预清零页池补充最多max个页，返回补充的页数。
+// 由调度器在没有可运行进程时调用，清零过程不持锁。
+// 空闲页低于高水位时不补充，以免与回收相互抵消。
+int
+kzero_refill(int max)
+{
+  struct run *r;
+  int n = 0;
+
+  while(n < max){
+    acquire(&zpool.lock);
+    int full = zpool.count >= ZPOOL_TARGET;
+    release(&zpool.lock);
+    if(full || buddy_nr_free() < wmark.high || (r = kalloc()) == 0)
+      break;
+
+    memset((char*)r, 0, PGSIZE);
+    page_set_owner(r, PGO_ZPOOL);
+
+    acquire(&zpool.lock);
+    r->next = zpool.list;
+    zpool.list = r;
+    zpool.count++;
+    zpool.zeroed++;
+    release(&zpool.lock);
+    n++;
+  }
+  return n;
+}
+
+// zpool shrinker：释放预清零页池中最多nr页
+static int
+kzero_shrink(int nr)
+{
+  struct run *r;
+  int n = 0;
+
+  while(n < nr){
+    acquire(&zpool.lock);
+    if((r = zpool.list) != 0){
+      zpool.list = r->next;
+      zpool.count--;
+    }
+    release(&zpool.lock);
+    if(r == 0)
+      break;
+    kfree(r);
+    n++;
+  }
+  return n;
+}
+
+// 把本CPU页缓存中的页全部归还伙伴系统（内存回收时使用）
+void
+kcache_flush(void)
+{
+  struct kcache *c;
+
+  push_off();
+  c = &kcache[cpuid()];
+  while(c->list)
+    kcache_drain(c);
+  pop_off();
+}
+
+// 打印分配器统计：每CPU缓存命中率与伙伴系统状态
+void
+kmem_stats(void)
+{
+  uint64 cached = 0;
+
+  printf("\n=== Page Allocator Stats ===\n");
+  printf("CPU\tCached\tAllocHit\tAllocMiss\tFreeHit\tFreeMiss\tEmpty\tHit%%\n");
+  for(int i = 0; i < NCPU; i++){
+    struct kcache *c = &kcache[i];
+    uint64 total = c->alloc_hits + c->alloc_miss;
+    if(total == 0 && c->free_hits + c->free_miss == 0)
+      continue;
+    printf("%d\t%d\t%d\t\t%d\t\t%d\t%d\t\t%d\t%d\n",
+           i, c->count, (int)c->alloc_hits, (int)c->alloc_miss,
+           (int)c->free_hits, (int)c->free_miss, (int)c->empty,
+           total ? (int)(c->alloc_hits * 100 / total) : 0);
+    cached += c->count;
+  }
+  printf("cached in per-CPU lists: %d pages\n", (int)cached);
+  printf("zero pool: %d pages, hits=%d misses=%d zeroed-in-idle=%d\n",
+         zpool.count, (int)zpool.hits, (int)zpool.misses, (int)zpool.zeroed);
+  printf("============================\n");
+  debug_mem_table();
+  buddy_stats();
+  reclaim_stats();
+  vmalloc_stats();
+  textcache_stats();
+  swap_stats();
+  ksm_stats();
+}
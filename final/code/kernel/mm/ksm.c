@@ -0,0 +1,315 @@
+// 相同页合并（KSM）
+//
+// 后台进程ksmd每隔KSM_PERIOD次时钟中断醒来一次，沿各进程的用户页表
+// 扫描一批匿名页，计算页内容的哈希，把内容相同的页合并为一个只读物理页，
+// 各映射以写时复制方式共享它；写入时由vmfault()复制出私有副本。
+// 合并省下的页回到伙伴系统，可供块缓存等其他用途。
+//
+// 两张表：
+//   stable   已合并的页，按哈希分桶。表持有每页一个引用，
+//            映射全部解除（只剩表的引用）后在一轮扫描结束时释放。
+//   unstable 本轮扫描中见过的候选页（进程、虚拟地址），按哈希直接映射，
+//            不持有引用，使用前重新查页表并比较内容；每轮扫描结束时清空。
+// 扫描到一页时先查stable，再查unstable；unstable命中时把那一页提升为
+// stable页，再把当前页合并进去。
+//
+// 只合并仅由一个PTE映射的匿名页。查页表、比较内容和修改PTE期间用
+// proc_pin()固定映射者，这期间它不会运行，页的内容和映射都不会改变；
+// 正在其他CPU上运行的进程本轮跳过。
+// 合并后的页不在LRU上，不会被换出。
+
+#include "../type.h"
+#include "../def.h"
+#include "memlayout.h"
+#include "page.h"
+#include "slab.h"
+#include "../proc/spinlock.h"
+#include "../proc/proc.h"
+
+#define KSM_PAGES     256   // 每次醒来扫描的候选页数
+#define KSM_BATCH     32    // 每扫描这么多页让出一次CPU
+#define KSM_PERIOD    10    // 每隔多少次时钟中断唤醒ksmd
+#define KSM_NBUCKET   256   // stable表的桶数
+#define KSM_NUNSTABLE 1024  // unstable表的项数
+
+struct ksm_node {
+  uint hash;
+  void *pa;                 // 合并后的页
+  struct ksm_node *next;
+};
+
+struct {
+  struct spinlock lock;     // 保护ticks，ksmd睡眠用
+  struct kmem_cache *cache;
+  struct ksm_node *spare;   // 预先分配的节点，关中断期间不分配内存
+  struct ksm_node *stable[KSM_NBUCKET];
+  struct {
+    struct proc *p;
+    uint64 va;
+    uint hash;
+  } unstable[KSM_NUNSTABLE];
+
+  int proc;                 // 扫描游标：进程表下标和虚拟地址
+  uint64 va;
+  uint64 ticks;
+
+  uint64 scanned;           // 扫描过的候选页数
+  uint64 merged;            // 合并的次数
+  uint64 nstable;           // stable表中的页数
+  uint64 full_scans;        // 完成的整轮扫描数
+} ksm;
+
+static uint
+ksm_hash(void *pa)
+{
+  uint64 *w = (uint64*)pa;
+  uint64 h = 0xcbf29ce484222325UL;
+
+  for(int i = 0; i < PGSIZE / sizeof(uint64); i++)
+    h = (h ^ w[i]) * 0x100000001b3UL;
+  return h ^ (h >> 32);
+}
+
+// 只由一个PTE映射的用户匿名页才是合并的候选
+static int
+ksm_candidate(pte_t pte)
+{
+  struct page *pg;
+
+  if((pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U) || (pte & PTE_SHARED))
+    return 0;
+  pg = pa2page(PTE2PA(pte));
+  return pg->owner == PGO_ANON && pg->refcnt == 1;
+}
+
+// 返回进程p在va处的候选页PTE并固定p，用完后调用proc_unpin(p)。
+// p已退出、正在运行或该页不再是候选时返回0
+static pte_t*
+ksm_lookup(struct proc *p, uint64 va)
+{
+  pte_t *pte;
+
+  if(!proc_pin(p))
+    return 0;
+  if((pte = walk(p->pagetable, va, 0)) == 0 || !ksm_candidate(*pte)){
+    proc_unpin(p);
+    return 0;
+  }
+  return pte;
+}
+
+// 从游标处找下一个候选页，把游标移到它之后，返回时*pp已被固定；
+// 扫描完所有进程时返回0，游标回到开头
+static pte_t*
+ksm_next(struct proc **pp, uint64 *vap)
+{
+  pte_t *pte;
+
+  for(; ksm.proc < NPROC; ksm.proc++, ksm.va = USERBASE){
+    struct proc *p = &proc[ksm.proc];
+    if(!proc_pin(p))
+      continue;
+    while(ksm.va < USERTOP){
+      uint64 va = ksm.va;
+      if((pte = walk(p->pagetable, va, 0)) == 0){
+        // 整个叶子页表不存在
+        ksm.va = (va + LEVELSIZE(1)) & ~(LEVELSIZE(1) - 1);
+        continue;
+      }
+      ksm.va += PGSIZE;
+      if(ksm_candidate(*pte)){
+        *pp = p;
+        *vap = va;
+        return pte;
+      }
+    }
+    proc_unpin(p);
+  }
+  ksm.proc = 0;
+  ksm.va = USERBASE;
+  return 0;
+}
+
+static struct ksm_node*
+ksm_stable_find(uint hash, void *pa)
+{
+  struct ksm_node *n;
+
+  for(n = ksm.stable[hash % KSM_NBUCKET]; n; n = n->next)
+    if(n->hash == hash && memcmp(n->pa, pa, PGSIZE) == 0)
+      return n;
+  return 0;
+}
+
+// 把PTE改为只读，可写的改为写时复制
+static pte_t
+ksm_wrprotect(pte_t pte)
+{
+  if(pte & PTE_W)
+    pte = (pte & ~PTE_W) | PTE_COW;
+  return pte;
+}
+
+// 把*pte映射的页pa提升为stable页，返回它的节点，没有空闲节点时返回0
+static struct ksm_node*
+ksm_promote(struct proc *p, uint64 va, pte_t *pte, uint hash)
+{
+  void *pa = (void*)PTE2PA(*pte);
+  struct ksm_node *n;
+
+  if((n = ksm.spare) == 0)
+    return 0;
+  ksm.spare = 0;
+
+  *pte = ksm_wrprotect(*pte);
+  uvmflush(p, va, 1);
+  lru_del(pa);                 // 将被多个进程映射，不再有唯一的映射者
+  page_set_owner(pa, PGO_KSM);
+  kref_get(pa);                // stable表的引用
+
+  n->hash = hash;
+  n->pa = pa;
+  n->next = ksm.stable[hash % KSM_NBUCKET];
+  ksm.stable[hash % KSM_NBUCKET] = n;
+  ksm.nstable++;
+  return n;
+}
+
+// 让进程p在va处的*pte改为映射内容相同的stable页kpa，释放原来的页pa
+static void
+ksm_merge(struct proc *p, uint64 va, pte_t *pte, void *pa, void *kpa)
+{
+  kref_get(kpa);
+  *pte = PA2PTE(kpa) | PTE_FLAGS(ksm_wrprotect(*pte));
+  uvmflush(p, va, 1);
+  kfree(pa);
+  ksm.merged++;
+}
+
+// 处理进程p在va处的候选页
+static void
+ksm_scan_one(struct proc *p, uint64 va, pte_t *pte)
+{
+  void *pa = (void*)PTE2PA(*pte);
+  uint h = ksm_hash(pa);
+  struct ksm_node *n;
+  pte_t *upte;
+
+  ksm.scanned++;
+  if((n = ksm_stable_find(h, pa)) != 0){
+    ksm_merge(p, va, pte, pa, n->pa);
+    return;
+  }
+
+  struct proc *up = ksm.unstable[h % KSM_NUNSTABLE].p;
+  uint64 uva = ksm.unstable[h % KSM_NUNSTABLE].va;
+  if(up && ksm.unstable[h % KSM_NUNSTABLE].hash == h &&
+     (upte = ksm_lookup(up, uva)) != 0){
+    if(upte != pte && memcmp((void*)PTE2PA(*upte), pa, PGSIZE) == 0 &&
+       (n = ksm_promote(up, uva, upte, h)) != 0){
+      proc_unpin(up);
+      ksm.unstable[h % KSM_NUNSTABLE].p = 0;
+      ksm_merge(p, va, pte, pa, n->pa);
+      return;
+    }
+    proc_unpin(up);
+  }
+
+  ksm.unstable[h % KSM_NUNSTABLE].p = p;
+  ksm.unstable[h % KSM_NUNSTABLE].va = va;
+  ksm.unstable[h % KSM_NUNSTABLE].hash = h;
+}
+
+// 一轮扫描结束：释放已没有映射的stable页，清空unstable表
+static void
+ksm_pass_done(void)
+{
+  for(int i = 0; i < KSM_NBUCKET; i++){
+    struct ksm_node **np = &ksm.stable[i], *n;
+    while((n = *np) != 0){
+      if(kref_count(n->pa) == 1){
+        *np = n->next;
+        kfree(n->pa);
+        kmem_cache_free(ksm.cache, n);
+        ksm.nstable--;
+      } else {
+        np = &n->next;
+      }
+    }
+  }
+  memset(ksm.unstable, 0, sizeof(ksm.unstable));
+  ksm.full_scans++;
+}
+
+static void
+ksmd(void)
+{
+  struct proc *p;
+  uint64 va;
+  pte_t *pte;
+
+  for(;;){
+    for(int i = 0; i < KSM_PAGES; i++){
+      if(ksm.spare == 0)
+        ksm.spare = kmem_cache_alloc(ksm.cache);
+
+      push_off();
+      if((pte = ksm_next(&p, &va)) != 0){
+        ksm_scan_one(p, va, pte);
+        proc_unpin(p);
+      } else {
+        ksm_pass_done();
+      }
+      pop_off();
+
+      if(pte == 0)
+        break;
+      if(i % KSM_BATCH == KSM_BATCH - 1)
+        yield();
+    }
+    acquire(&ksm.lock);
+    sleep(&ksm, &ksm.lock);
+    release(&ksm.lock);
+  }
+}
+
+// 时钟中断中调用，定期唤醒ksmd
+void
+ksm_tick(void)
+{
+  acquire(&ksm.lock);
+  if(++ksm.ticks % KSM_PERIOD == 0)
+    wakeup(&ksm);
+  release(&ksm.lock);
+}
+
+// 启动ksmd。在procinit()之后调用
+void
+ksm_init(void)
+{
+  initlock(&ksm.lock, "ksm");
+  ksm.cache = kmem_cache_create("ksm_node", sizeof(struct ksm_node), 0);
+  ksm.proc = 0;
+  ksm.va = USERBASE;
+  if(create_process(ksmd, "ksmd", MIN_PRIORITY) < 0)
+    panic("ksm_init");
+}
+
+// 打印合并统计：sharing为映射到stable页的PTE数，saved为因此省下的页数
+void
+ksm_stats(void)
+{
+  uint64 sharing = 0;
+
+  push_off();
+  for(int i = 0; i < KSM_NBUCKET; i++)
+    for(struct ksm_node *n = ksm.stable[i]; n; n = n->next)
+      sharing += kref_count(n->pa) - 1;
+  pop_off();
+
+  printf("ksm: scanned=%d merged=%d full scans=%d\n",
+         (int)ksm.scanned, (int)ksm.merged, (int)ksm.full_scans);
+  printf("  stable pages=%d sharing=%d saved=%d pages\n",
+         (int)ksm.nstable, (int)sharing,
+         (int)(sharing > ksm.nstable ? sharing - ksm.nstable : 0));
+}
@@ -36,8 +36,12 @@
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
+// PHYSTOP在启动时由fdt_init()根据设备树的/memory节点确定，
+// 没有设备树时使用PHYSTOP_DEFAULT（qemu -m 128M）。
 #define KERNBASE 0x80000000L
-#define PHYSTOP (KERNBASE + 128*1024*1024)
+#define PHYSTOP_DEFAULT (KERNBASE + 128*1024*1024)
+extern unsigned long phystop;
+#define PHYSTOP phystop
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -47,6 +51,12 @@
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
+// vmalloc()的内核虚拟地址区：内核栈和trampoline所在的最高1GiB之下的1GiB。
+// 整个区由一个根页表项覆盖，其二级页表在启动时预先分配，
+// 进程页表复制该根页表项后共享区内之后建立的所有映射。
+#define VMALLOC_END   (MAXVA - (1L << 30))
+#define VMALLOC_START (VMALLOC_END - (1L << 30))
+
 // User memory layout.
 // Address zero first:
 //   text
@@ -57,3 +67,10 @@
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// 进程的用户区为 [0, USERTOP)，位于根页表0号表项覆盖的低1GiB内、
+// PLIC等设备寄存器之下。该表项之外的映射与内核页表共享。
+#define USERTOP PLIC
+
+// 进程堆（sbrk）从USERBASE开始，0号页保持不映射以捕获空指针访问
+#define USERBASE PGSIZE
@@ -0,0 +1,657 @@
+// 文件内存映射
+//
+// mmap()只在进程的映射区表中登记 [start, start+len) 与文件区间的对应关系，
+// 不分配物理页。第一次访问某页时由mmap_fault()分配一页，经块缓存读入
+// 文件内容（文件末尾之后补0）后映射，之后的访问不再经过文件系统，
+// 也没有fileread()逐次调用的复制和filewrite()的分段开销。
+// 映射区从USERTOP向下分配，堆从p->heapbase向上增长。
+//
+// 私有映射(MAP_PRIVATE)的写入只修改本进程的页。共享映射(MAP_SHARED)的页
+// 取自按文件(dev, inum)索引的页缓存，映射同一文件的所有进程（包括fork出的
+// 子进程）映射同一物理页，一方的写入另一方立即可见；write()写文件时同时
+// 更新缓存中的页。munmap、MADV_DONTNEED和进程退出时把本进程写过(PTE_D)的
+// 页整页写回文件，页中也包含其他映射者的写入，因此不会覆盖它们。
+//
+// exec()把程序的各个装入段登记为私有映射区(MAP_IMAGE)，同样在缺页时才读入。
+// 只读段的页放在同一缓存的文本缓存项中，运行同一程序的所有进程只读映射
+// 同一份物理页，再次exec时命中缓存的页也不必读文件。文件被写入后文本缓存项
+// 作废，已有的映射继续使用旧页，之后的exec建立新的缓存项。
+// 只有缓存持有的页由text shrinker在内存紧张时释放；共享映射的页在各映射者
+// 解除映射时已经写回，释放时不必再写。
+
+#include "../type.h"
+#include "../def.h"
+#include "memlayout.h"
+#include "mmap.h"
+#include "page.h"
+#include "swap.h"
+#include "reclaim.h"
+#include "../proc/spinlock.h"
+#include "../proc/proc.h"
+#include "../fs/fs.h"
+#include "../fs/file.h"
+#include "../fs/log.h"
+
+// 写回时每个日志事务写入的最大字节数，与filewrite()一致
+#define MMAP_WB_MAX (((10 - 1 - 1 - 2) / 2) * BSIZE)
+
+// 共享映射的缓存项覆盖文件的最大长度，write()使文件变长后新的内容也在缓存中
+#define SHARED_NPAGES (PGROUNDUP(MAXFILE * BSIZE) / PGSIZE)
+
+// 一个文件的页缓存：程序的只读页（文本缓存项），或共享映射的页
+struct textcache {
+  int used;
+  int shared;          // 共享映射的页：写文件时更新页而不作废
+  int stale;           // 文本缓存项：文件已被写入，不再用于新的exec
+  uint dev;
+  uint inum;
+  int ref;             // 引用它的映射区数，为0时仍保留以便下次exec命中
+  uint npages;         // 文件的页数
+  void **pages;        // 各文件页的物理页（缓存持有一个引用），0表示尚未读入
+};
+
+struct {
+  struct spinlock lock;
+  struct textcache tc[NTEXT];
+  uint64 hits;
+  uint64 misses;
+} text;
+
+static struct shrinker text_shrinker;
+
+// 查找包含va的映射区
+static struct vma*
+vma_find(struct proc *p, uint64 va)
+{
+  for(int i = 0; i < NVMA; i++){
+    struct vma *v = &p->vma[i];
+    if(v->used && va >= v->start && va < v->start + v->len)
+      return v;
+  }
+  return 0;
+}
+
+// 所有mmap映射区的最低地址，堆不能增长到它之上（程序段位于堆之下，不计入）
+uint64
+mmap_floor(struct proc *p)
+{
+  uint64 floor = USERTOP;
+
+  for(int i = 0; i < NVMA; i++){
+    struct vma *v = &p->vma[i];
+    if(v->used && (v->flags & MAP_IMAGE) == 0 && v->start < floor)
+      floor = v->start;
+  }
+  return floor;
+}
+
+// ========== 文本缓存 ==========
+
+// 释放缓存项t持有的所有页，返回页数。调用者持有text.lock且t->ref为0
+static int
+text_release(struct textcache *t)
+{
+  int n = 0;
+
+  for(uint i = 0; i < t->npages; i++){
+    if(t->pages[i]){
+      kfree(t->pages[i]);
+      n++;
+    }
+  }
+  vfree(t->pages);
+  t->pages = 0;
+  t->used = 0;
+  return n;
+}
+
+// 返回文件ip的缓存项（shared为1时是共享映射的缓存项，覆盖npages页）
+// 并增加引用，缓存已满且都在使用时返回0
+static struct textcache*
+cache_get(struct inode *ip, int shared, uint npages)
+{
+  struct textcache *t, *victim = 0;
+  void **pages;
+
+  if(npages == 0)
+    return 0;
+  // vmalloc()可能触发回收，回收会调用text shrinker，因此在持锁之前分配
+  if((pages = vmalloc(npages * sizeof(void*))) == 0)
+    return 0;
+  memset(pages, 0, npages * sizeof(void*));
+
+  acquire(&text.lock);
+  for(t = text.tc; t < &text.tc[NTEXT]; t++){
+    if(t->used && t->shared == shared && !t->stale &&
+       t->dev == ip->dev && t->inum == ip->inum){
+      t->ref++;
+      release(&text.lock);
+      vfree(pages);
+      return t;
+    }
+  }
+  // 优先用空闲项，否则淘汰一个没有映射区引用的旧项
+  for(t = text.tc; t < &text.tc[NTEXT]; t++){
+    if(!t->used){
+      victim = t;
+      break;
+    }
+    if(t->ref == 0 && victim == 0)
+      victim = t;
+  }
+  if((t = victim) != 0){
+    if(t->used)
+      text_release(t);
+    t->used = 1;
+    t->shared = shared;
+    t->stale = 0;
+    t->dev = ip->dev;
+    t->inum = ip->inum;
+    t->ref = 1;
+    t->npages = npages;
+    t->pages = pages;
+    pages = 0;
+  }
+  release(&text.lock);
+  if(pages)
+    vfree(pages);
+  return t;
+}
+
+// 返回文件ip的文本缓存项并增加引用，缓存已满且都在使用时返回0。
+// 调用者持有ip的锁。
+struct textcache*
+text_get(struct inode *ip)
+{
+  return cache_get(ip, 0, PGROUNDUP(ip->size) / PGSIZE);
+}
+
+static void
+text_dup(struct textcache *t)
+{
+  acquire(&text.lock);
+  t->ref++;
+  release(&text.lock);
+}
+
+// 释放映射区对缓存项t的引用。作废的项在最后一个引用释放时回收
+void
+text_put(struct textcache *t)
+{
+  acquire(&text.lock);
+  if(t->ref < 1)
+    panic("text_put");
+  if(--t->ref == 0 && t->stale)
+    text_release(t);
+  release(&text.lock);
+}
+
+// 文件ip将被写入（由writei()调用）：作废它的文本缓存项
+void
+text_invalidate(struct inode *ip)
+{
+  acquire(&text.lock);
+  for(struct textcache *t = text.tc; t < &text.tc[NTEXT]; t++){
+    if(!t->used || t->shared || t->stale || t->dev != ip->dev || t->inum != ip->inum)
+      continue;
+    t->stale = 1;
+    if(t->ref == 0)
+      text_release(t);
+  }
+  release(&text.lock);
+}
+
+// writei()刚把src处的n字节写到文件ip的偏移off：更新共享映射缓存项中
+// 已读入的页，映射者随即看到新内容
+void
+text_write(struct inode *ip, uint off, uint64 src, uint n)
+{
+  struct textcache *t;
+  uint end = off + n, m;
+
+  acquire(&text.lock);
+  for(t = text.tc; t < &text.tc[NTEXT]; t++)
+    if(t->used && t->shared && t->dev == ip->dev && t->inum == ip->inum)
+      break;
+  for(; t < &text.tc[NTEXT] && off < end; off += m, src += m){
+    m = PGSIZE - off % PGSIZE;
+    if(m > end - off)
+      m = end - off;
+    if(off / PGSIZE < t->npages && t->pages[off / PGSIZE])
+      memmove((char*)t->pages[off / PGSIZE] + off % PGSIZE, (char*)src, m);
+  }
+  release(&text.lock);
+}
+
+// 返回缓存项t中文件第idx页的物理页，并为调用者的映射增加一个引用。
+// 页不在缓存中时从ip读入，*miss置1。内存不足返回0。
+static void*
+text_page(struct textcache *t, struct inode *ip, uint idx, int *miss)
+{
+  char *mem, *pa;
+  int n;
+
+  *miss = 0;
+  acquire(&text.lock);
+  if((pa = t->pages[idx]) != 0){
+    kref_get(pa);
+    text.hits++;
+    release(&text.lock);
+    return pa;
+  }
+  release(&text.lock);
+
+  // 不持锁读文件，读完后再检查一次是否已被别的进程放入
+  if((mem = kalloc()) == 0)
+    return 0;
+  ilock(ip);
+  n = readi(ip, 0, (uint64)mem, idx * PGSIZE, PGSIZE);
+  iunlock(ip);
+  if(n < 0)
+    n = 0;
+  memset(mem + n, 0, PGSIZE - n);
+  page_set_owner(mem, PGO_FILE);
+
+  acquire(&text.lock);
+  if((pa = t->pages[idx]) == 0){
+    t->pages[idx] = pa = mem;
+    mem = 0;
+    text.misses++;
+    *miss = 1;
+  } else {
+    text.hits++;
+  }
+  kref_get(pa);
+  release(&text.lock);
+  if(mem)
+    kfree(mem);
+  return pa;
+}
+
+// text shrinker：释放只有缓存持有的页，以及没有引用的缓存项
+static int
+text_scan(int nr)
+{
+  int freed = 0;
+
+  acquire(&text.lock);
+  for(struct textcache *t = text.tc; t < &text.tc[NTEXT] && freed < nr; t++){
+    if(!t->used)
+      continue;
+    for(uint i = 0; i < t->npages && freed < nr; i++){
+      if(t->pages[i] && kref_count(t->pages[i]) == 1){
+        kfree(t->pages[i]);
+        t->pages[i] = 0;
+        freed++;
+      }
+    }
+    if(t->ref == 0)
+      freed += text_release(t);
+  }
+  release(&text.lock);
+  return freed;
+}
+
+// 初始化文本缓存，注册text shrinker。在reclaim_init()之后调用
+void
+textcache_init(void)
+{
+  initlock(&text.lock, "text");
+  text_shrinker.name = "text";
+  text_shrinker.scan = text_scan;
+  register_shrinker(&text_shrinker);
+}
+
+// 打印文本缓存统计
+void
+textcache_stats(void)
+{
+  int n = 0, shared = 0, cached = 0;
+
+  acquire(&text.lock);
+  for(struct textcache *t = text.tc; t < &text.tc[NTEXT]; t++){
+    if(!t->used)
+      continue;
+    n++;
+    shared += t->shared;
+    for(uint i = 0; i < t->npages; i++)
+      if(t->pages[i])
+        cached++;
+  }
+  release(&text.lock);
+  printf("text cache: %d files (%d shared), %d pages, hits=%d misses=%d\n",
+         n, shared, cached, (int)text.hits, (int)text.misses);
+}
+
+// 读出文本缓存的命中次数和未命中（读文件）次数
+void
+textcache_counts(uint64 *hits, uint64 *misses)
+{
+  acquire(&text.lock);
+  *hits = text.hits;
+  *misses = text.misses;
+  release(&text.lock);
+}
+
+// ========== 映射区 ==========
+
+// 映射区v中的页va以权限perm映射缓存中的页
+static int
+vma_fill_cached(struct proc *p, struct vma *v, uint64 va, int perm)
+{
+  uint idx = (v->off + (va - v->start)) / PGSIZE;
+  int miss;
+  void *pa;
+
+  if(idx >= v->tc->npages)
+    return -1;
+  if((pa = text_page(v->tc, v->f->ip, idx, &miss)) == 0)
+    return -1;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)pa, perm) != 0){
+    kfree(pa);
+    return -1;
+  }
+  p->rss++;
+  if(miss)
+    p->majflt++;
+  else
+    p->minflt++;
+  return 0;
+}
+
+// 为映射区v中的页va分配物理页、读入文件内容并映射。
+// 页已映射时直接返回。成功返回0。
+static int
+vma_fill(struct proc *p, struct vma *v, uint64 va)
+{
+  struct inode *ip = v->f->ip;
+  uint64 rel = va - v->start;
+  pte_t *pte;
+  char *mem;
+  int perm, n = 0;
+
+  // 已映射，或私有映射中写过的页已被换出（缺页时由vmfault()换入）
+  pte = walk(p->pagetable, va, 0);
+  if(pte && *pte != 0)
+    return 0;
+
+  // 只有W没有R的PTE是保留编码，映射区总是可读。
+  // 程序在S模式下运行，S模式不能执行带PTE_U的页
+  if(v->prot & PROT_EXEC)
+    perm = PTE_R | PTE_X;
+  else
+    perm = PTE_U | PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->flags & MAP_SHARED)
+    perm |= PTE_SHARED;
+
+  if(v->tc)
+    return vma_fill_cached(p, v, va, perm);
+
+  if((mem = kalloc()) == 0)
+    return -1;
+
+  // 程序段中fsize之后的部分（.bss）不读文件
+  if(rel < v->fsize){
+    ilock(ip);
+    n = readi(ip, 0, (uint64)mem, v->off + rel,
+              v->fsize - rel < PGSIZE ? v->fsize - rel : PGSIZE);
+    iunlock(ip);
+    if(n < 0)
+      n = 0;
+  }
+  memset(mem + n, 0, PGSIZE - n);
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  lru_add(mem, p, va, PGO_FILE);
+  p->rss++;
+  p->majflt++;
+  return 0;
+}
+
+// 把共享映射中被写过的页pa写回文件。页在缓存中，写回时writei()用同样的
+// 内容更新缓存，不会改变它
+static void
+vma_writeback(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->start);
+  uint n;
+
+  // 不扩展文件：只写回文件末尾之前的部分
+  ilock(ip);
+  n = ip->size > off ? ip->size - off : 0;
+  iunlock(ip);
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  for(uint i = 0; i < n; ){
+    uint n1 = n - i;
+    if(n1 > MMAP_WB_MAX)
+      n1 = MMAP_WB_MAX;
+    begin_op();
+    ilock(ip);
+    writei(ip, 0, pa + i, off + i, n1);
+    iunlock(ip);
+    end_op();
+    i += n1;
+  }
+}
+
+// 解除映射区v中 [va, end) 的映射，必要时先写回
+static void
+vma_unmap(struct proc *p, struct vma *v, uint64 va, uint64 end)
+{
+  uint64 start = va;
+  pte_t *pte;
+  int n = 0;
+
+  for(; va < end; va += PGSIZE){
+    pte = walk(p->pagetable, va, 0);
+    if(pte && PTE_SWAPPED(*pte)){
+      swap_free(SWP_SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if((v->flags & MAP_SHARED) && (*pte & PTE_D))
+      vma_writeback(v, va, PTE2PA(*pte));
+    kfree((void*)PTE2PA(*pte));
+    *pte = 0;
+    p->rss--;
+    n++;
+  }
+  if(n)
+    uvmflush(p, start, (end - start) / PGSIZE);
+}
+
+// 建立文件fd从off开始、长度len的映射，返回映射的起始地址，失败返回-1
+uint64
+mmap(uint64 len, int prot, int flags, int fd, uint off)
+{
+  struct proc *p = myproc();
+  struct textcache *tc = 0;
+  struct vma *v = 0;
+  struct file *f;
+  uint64 floor;
+
+  if(len == 0 || (off % PGSIZE) != 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(fd < 0 || fd >= NOFILE || (f = p->ofile[fd]) == 0 || f->type != FD_INODE)
+    return -1;
+  if(!f->readable)
+    return -1;
+  if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+
+  len = PGROUNDUP(len);
+  floor = mmap_floor(p);
+  if(floor < len || floor - len < PGROUNDUP(p->sz))
+    return -1;
+
+  for(int i = 0; i < NVMA; i++){
+    if(!p->vma[i].used){
+      v = &p->vma[i];
+      break;
+    }
+  }
+  if(v == 0)
+    return -1;
+  // 共享映射的页取自文件的页缓存，各映射者映射同一物理页
+  if((flags & MAP_SHARED) && (tc = cache_get(f->ip, 1, SHARED_NPAGES)) == 0)
+    return -1;
+
+  v->used = 1;
+  v->start = floor - len;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->advice = MADV_NORMAL;
+  v->f = filedup(f);
+  v->off = off;
+  v->fsize = len;
+  v->tc = tc;
+
+  if(flags & MAP_POPULATE){
+    for(uint64 va = v->start; va < v->start + len; va += PGSIZE)
+      if(vma_fill(p, v, va) != 0)
+        break;
+  }
+  return v->start;
+}
+
+// 释放映射区v对文件和页缓存的引用
+static void
+vma_release(struct vma *v)
+{
+  if(v->tc)
+    text_put(v->tc);
+  fileclose(v->f);
+  v->f = 0;
+  v->tc = 0;
+  v->used = 0;
+}
+
+// 解除 [addr, addr+len) 的映射。区间必须位于一个映射区的开头或结尾。
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 end;
+
+  if((addr % PGSIZE) != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  end = addr + len;
+  if((v = vma_find(p, addr)) == 0 || end > v->start + v->len)
+    return -1;
+
+  if(addr == v->start){
+    vma_unmap(p, v, addr, end);
+    v->start += len;
+    v->off += len;
+    v->fsize = v->fsize > len ? v->fsize - len : 0;
+    v->len -= len;
+  } else if(end == v->start + v->len){
+    vma_unmap(p, v, addr, end);
+    v->len -= len;
+  } else {
+    return -1;  // 不支持在映射区中间打洞
+  }
+
+  if(v->len == 0)
+    vma_release(v);
+  return 0;
+}
+
+// 对 [addr, addr+len) 给出访问提示，区间必须位于一个映射区内
+int
+madvise(uint64 addr, uint64 len, int advice)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 end;
+
+  if((addr % PGSIZE) != 0)
+    return -1;
+  end = addr + PGROUNDUP(len);
+  if((v = vma_find(p, addr)) == 0 || end > v->start + v->len)
+    return -1;
+
+  switch(advice){
+  case MADV_NORMAL:
+  case MADV_SEQUENTIAL:
+    v->advice = advice;
+    return 0;
+  case MADV_WILLNEED:
+    for(; addr < end; addr += PGSIZE)
+      if(vma_fill(p, v, addr) != 0)
+        return -1;
+    return 0;
+  case MADV_DONTNEED:
+    vma_unmap(p, v, addr, end);
+    return 0;
+  }
+  return -1;
+}
+
+// 处理映射区中的缺页，权限不符或内存不足时返回-1，va不在任何映射区内时返回1
+int
+mmap_fault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+
+  if((v = vma_find(p, va)) == 0)
+    return 1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+
+  va = PGROUNDDOWN(va);
+  if(vma_fill(p, v, va) != 0)
+    return -1;
+
+  // 顺序访问时顺带填充后续的页，减少缺页次数
+  if(v->advice == MADV_SEQUENTIAL){
+    for(int i = 1; i <= MMAP_FAULTAROUND; i++){
+      uint64 a = va + i * PGSIZE;
+      if(a >= v->start + v->len || vma_fill(p, v, a) != 0)
+        break;
+    }
+  }
+  return 0;
+}
+
+// fork时复制映射区表，页表由uvmcopy()复制
+void
+mmap_dup(struct proc *p, struct proc *np)
+{
+  for(int i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(!np->vma[i].used)
+      continue;
+    filedup(np->vma[i].f);
+    if(np->vma[i].tc)
+      text_dup(np->vma[i].tc);
+  }
+}
+
+// 进程退出时解除所有映射，共享映射写回文件
+void
+mmap_exit(struct proc *p)
+{
+  for(int i = 0; i < NVMA; i++){
+    struct vma *v = &p->vma[i];
+    if(!v->used)
+      continue;
+    vma_unmap(p, v, v->start, v->start + v->len);
+    vma_release(v);
+  }
+}
@@ -0,0 +1,63 @@
+// 文件内存映射（mmap）
+#ifndef MMAP_H
+#define MMAP_H
+
+#include "../type.h"
+
+struct file;
+struct inode;
+struct proc;
+struct textcache;
+
+#define NVMA 16          // 每个进程最多的映射区数
+#define NTEXT 8          // 页缓存最多缓存的文件数（程序文件和共享映射的文件）
+#define MMAP_FAULTAROUND 8  // 顺序访问提示下，每次缺页额外填充的页数
+
+// mmap的prot参数
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4     // 只用于exec加载的程序段，页不带PTE_U以便S模式执行
+
+// mmap的flags参数
+#define MAP_SHARED   0x01  // 映射同一文件的进程共享页，写入在munmap/退出时写回文件
+#define MAP_PRIVATE  0x02  // 写入只对本进程可见
+#define MAP_POPULATE 0x08  // 建立映射时立即填充所有页
+#define MAP_IMAGE    0x10  // 内部使用：exec加载的程序段，位于堆之下
+
+// madvise的advice参数
+#define MADV_NORMAL     0
+#define MADV_SEQUENTIAL 2  // 顺序访问：缺页时预先填充后续页
+#define MADV_WILLNEED   3  // 立即填充区间内的页
+#define MADV_DONTNEED   4  // 丢弃区间内的页（共享映射先写回）
+
+// 进程地址空间中的一个文件映射区 [start, start+len)
+struct vma {
+  int used;
+  uint64 start;        // 页对齐
+  uint64 len;          // 页对齐
+  int prot;
+  int flags;
+  int advice;          // madvise提示
+  struct file *f;      // 映射的文件（持有一个引用）
+  uint off;            // start对应的文件偏移，页对齐
+  uint fsize;          // 从off起取自文件的字节数，其后的部分补0
+  struct textcache *tc; // 只读程序段或共享映射的页缓存（持有一个引用），否则为0
+};
+
+// mmap.c
+uint64 mmap(uint64 len, int prot, int flags, int fd, uint off);
+int    munmap(uint64 addr, uint64 len);
+int    madvise(uint64 addr, uint64 len, int advice);
+int    mmap_fault(struct proc *p, uint64 va, int write);
+void   mmap_dup(struct proc *p, struct proc *np);
+void   mmap_exit(struct proc *p);
+uint64 mmap_floor(struct proc *p);
+void   textcache_init(void);
+struct textcache* text_get(struct inode *ip);
+void   text_put(struct textcache *t);
+void   text_invalidate(struct inode *ip);
+void   text_write(struct inode *ip, uint off, uint64 src, uint n);
+void   textcache_stats(void);
+void   textcache_counts(uint64 *hits, uint64 *misses);
+
+#endif // MMAP_H
@@ -0,0 +1,84 @@
+// 物理页描述符与伙伴系统接口
+#ifndef PAGE_H
+#define PAGE_H
+
+#include "../type.h"
+#include "riscv.h"
+#include "memlayout.h"
+
+// 伙伴系统的阶数：0..MAX_ORDER-1，最大块为 2^(MAX_ORDER-1) 页 (4 MiB)
+#define MAX_ORDER 11
+
+// 页标志
+#define PG_RESERVED (1 << 0)  // 内核镜像或页描述符数组，不参与分配
+#define PG_BUDDY    (1 << 1)  // 空闲块的首页，挂在伙伴系统空闲链表上
+#define PG_HEAD     (1 << 2)  // 已分配块的首页，order有效
+#define PG_LRU      (1 << 3)  // 用户页，挂在LRU链表上
+
+// 页的所有者类别（已分配块的首页有效）
+enum {
+  PGO_FREE,        // 空闲（伙伴系统或每CPU页缓存中）
+  PGO_KERNEL,      // 其他内核用途
+  PGO_PAGETABLE,   // 页表页
+  PGO_SLAB,        // slab（未单独归类的cache）
+  PGO_TRAPFRAME,   // trapframe cache的slab
+  PGO_BCACHE,      // 块缓存(buf cache)的slab
+  PGO_KSTACK,      // 内核栈
+  PGO_ZPOOL,       // 预清零页池
+  PGO_ANON,        // 用户匿名页（堆、写时复制的副本）
+  PGO_FILE,        // 用户文件映射页
+  PGO_KSM,         // 合并后由多个用户映射共享的只读页
+  PGO_VMALLOC,     // vmalloc()映射的页
+  NPGO
+};
+
+struct proc;
+
+// 每个物理页一个描述符，按物理地址从KERNBASE起线性排列
+struct page {
+  uint flags;
+  int order;            // 块的阶数（仅首页有效）
+  int refcnt;           // 映射此页的页表项数（写时复制共享），kalloc()时为1
+  int owner;            // 所有者类别 PGO_*
+  struct page *next;    // 空闲时：伙伴系统空闲链表；用户页：LRU链表
+  struct page *prev;
+  struct proc *mapper;  // 用户页的映射者（反向映射，回收时用于找到PTE）
+  uint64 va;            // 用户页在mapper中的虚拟地址
+};
+
+extern struct page *pages;
+extern uint64 npages;
+
+#define pa2page(pa) (&pages[((uint64)(pa) - KERNBASE) >> PGSHIFT])
+#define page2pa(pg) (KERNBASE + ((uint64)((pg) - pages) << PGSHIFT))
+
+// 设置页的所有者类别
+#define page_set_owner(pa, o) page_owner(pa2page(pa), (o))
+
+// 物理内存统计（SYS_MEMSTAT），单位为页
+struct memstat {
+  uint64 total;          // 伙伴系统管理的页数
+  uint64 free;           // 空闲页（伙伴系统和每CPU页缓存中）
+  uint64 used;           // 已分配的页，不含预清零页池
+  uint64 zeroed;         // 预清零页池中的页
+  uint64 live[NPGO];     // 各所有者类别当前的页数（PGO_FREE项不用）
+  uint64 peak[NPGO];     // 各所有者类别页数的峰值
+};
+
+// kalloc.c
+void  page_owner(struct page *pg, int owner);
+void  kmem_getstat(struct memstat *st);
+
+// buddy.c
+void  buddy_init(void *pa_start, void *pa_end);
+int   buddy_alloc_batch(void **pa, int n);
+void  buddy_free_batch(void **pa, int n);
+
+// reclaim.c
+void  lru_add(void *pa, struct proc *p, uint64 va, int owner);
+void  lru_del(void *pa);
+void  lru_del_batch(void **pa, int n);
+int   lru_isolate(int owner, struct page **out, int nr);
+pte_t* lru_mapped_pte(struct page *pg);
+
+#endif // PAGE_H
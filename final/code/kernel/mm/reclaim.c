@@ -0,0 +1,367 @@
+// 内存回收
+//
+// 空闲页数（伙伴系统中的空闲页加上尚未初始化的延迟区间）低于低水位时，
+// kalloc()唤醒回收守护进程kreclaimd，它依次调用各个shrinker，
+// 直到空闲页回到高水位。kalloc()在分配失败时还会同步回收一次再重试，
+// 因此缓存占用的内存总能在分配失败之前被收回。
+//
+// shrinker按注册顺序调用：
+//   zpool     预清零页池（kinit()注册）
+//   slab      各slab cache中完全空闲的slab
+//   pagecache 文件映射中未修改的页，可以从文件重新读入
+//   text      文本缓存中没有进程映射的程序页（textcache_init()注册）
+//   bcache    块缓存中超出初始数量的空闲缓冲区（binit()注册）
+//   swap      把最久未访问的匿名页压缩或换出到交换区（swapinit()注册）
+// 最后把本CPU页缓存中的页归还伙伴系统，使回收的页计入空闲页数。
+//
+// 用户页（匿名页和文件映射页）按最近使用顺序挂在LRU链表上，
+// 页描述符记录它的映射者和虚拟地址（单映射反向映射），
+// 回收时据此找到PTE。映射者可能已失效（fork后共享、进程已退出），
+// 因此使用前总要确认该PTE仍指向这一页且页只有一个引用。
+// 访问映射者的页表前先用proc_pin()固定它，正在其他CPU上运行的进程的页
+// 暂不处理（见vm.c，修改页表后只刷新本CPU的TLB）。
+
+#include "../type.h"
+#include "../def.h"
+#include "memlayout.h"
+#include "page.h"
+#include "reclaim.h"
+#include "slab.h"
+#include "../proc/spinlock.h"
+#include "../proc/proc.h"
+
+#define RECLAIM_BATCH 32   // kreclaimd每轮回收的页数
+
+struct watermarks wmark;
+
+struct {
+  struct spinlock lock;
+  struct page *head;         // 最近使用
+  struct page *tail;         // 最久未使用
+  uint64 nr;
+} lru;
+
+struct {
+  struct spinlock lock;      // kreclaimd睡眠和唤醒
+  struct shrinker *list;
+  int running;               // 正在回收，防止回收过程中分配内存时递归，也防止多个CPU同时回收
+  uint64 wakeups;            // kreclaimd被唤醒的次数
+  uint64 direct;             // kalloc()同步回收的次数
+  uint64 daemon_pages;       // kreclaimd回收的页数
+  uint64 direct_pages;       // 同步回收的页数
+} reclaim;
+
+static struct shrinker slab_shrinker;
+static struct shrinker pagecache_shrinker;
+
+void
+register_shrinker(struct shrinker *s)
+{
+  struct shrinker **pp = &reclaim.list;
+
+  // 追加到末尾，保持注册顺序
+  while(*pp)
+    pp = &(*pp)->next;
+  s->next = 0;
+  s->reclaimed = 0;
+  *pp = s;
+}
+
+// ========== LRU ==========
+
+static void
+lru_unlink(struct page *pg)
+{
+  if(pg->prev)
+    pg->prev->next = pg->next;
+  else
+    lru.head = pg->next;
+  if(pg->next)
+    pg->next->prev = pg->prev;
+  else
+    lru.tail = pg->prev;
+  pg->next = pg->prev = 0;
+  pg->flags &= ~PG_LRU;
+  lru.nr--;
+}
+
+static void
+lru_push(struct page *pg)
+{
+  pg->prev = 0;
+  pg->next = lru.head;
+  if(lru.head)
+    lru.head->prev = pg;
+  else
+    lru.tail = pg;
+  lru.head = pg;
+  pg->flags |= PG_LRU;
+  lru.nr++;
+}
+
+// 把用户页pa登记为进程p在va处的映射，并移到LRU头部
+void
+lru_add(void *pa, struct proc *p, uint64 va, int owner)
+{
+  struct page *pg = pa2page(pa);
+
+  acquire(&lru.lock);
+  if(pg->flags & PG_LRU)
+    lru_unlink(pg);
+  page_owner(pg, owner);
+  pg->mapper = p;
+  pg->va = va;
+  lru_push(pg);
+  release(&lru.lock);
+}
+
+// 页被释放时从LRU上摘下（由kfree()调用）
+void
+lru_del(void *pa)
+{
+  struct page *pg = pa2page(pa);
+
+  acquire(&lru.lock);
+  if(pg->flags & PG_LRU)
+    lru_unlink(pg);
+  pg->mapper = 0;
+  release(&lru.lock);
+}
+
+// 批量释放页时一次加锁把其中的用户页从LRU上摘下
+void
+lru_del_batch(void **pa, int n)
+{
+  acquire(&lru.lock);
+  for(int i = 0; i < n; i++){
+    struct page *pg = pa2page(pa[i]);
+    if(pg->flags & PG_LRU)
+      lru_unlink(pg);
+    pg->mapper = 0;
+  }
+  release(&lru.lock);
+}
+
+// 如果pg仍唯一地映射在其mapper的va处，固定mapper并返回该PTE，否则返回0。
+// 调用者持有lru.lock，用完后调用proc_unpin(pg->mapper)
+static pte_t*
+lru_pte(struct page *pg)
+{
+  struct proc *p = pg->mapper;
+  pte_t *pte;
+
+  if(p == 0 || pg->refcnt != 1 || !proc_pin(p))
+    return 0;
+  pte = walk(p->pagetable, pg->va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || PTE2PA(*pte) != page2pa(pg)){
+    proc_unpin(p);
+    return 0;
+  }
+  return pte;
+}
+
+// 第二次机会（时钟）扫描：从LRU尾部挑选最多nr个owner类别、
+// 仅映射在其mapper中且最近未被访问的页，增加一个引用后放入out，
+// 调用者处理完后用kfree()释放这个引用。
+// 最近被访问过(PTE_A)的页清除访问位后移回头部，再给一次机会。
+int
+lru_isolate(int owner, struct page **out, int nr)
+{
+  struct page *pg, *prev;
+  struct proc *p;
+  uint64 scanned = 0, limit;
+  int n = 0;
+  pte_t *pte;
+
+  acquire(&lru.lock);
+  limit = lru.nr;
+  for(pg = lru.tail; pg && n < nr && scanned < limit; pg = prev, scanned++){
+    prev = pg->prev;
+    if(pg->owner != owner || (pte = lru_pte(pg)) == 0)
+      continue;
+    p = pg->mapper;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      lru_unlink(pg);
+      lru_push(pg);
+    } else {
+      __sync_fetch_and_add(&pg->refcnt, 1);
+      out[n++] = pg;
+    }
+    proc_unpin(p);
+  }
+  release(&lru.lock);
+  return n;
+}
+
+// 如果用户页pg仍映射在其mapper的va处，且除调用者持有的引用外
+// 没有其他共享者，固定mapper并返回该PTE。调用时必须关中断，
+// 处理完后调用proc_unpin()。
+pte_t*
+lru_mapped_pte(struct page *pg)
+{
+  struct proc *p = pg->mapper;
+  pte_t *pte;
+
+  if(p == 0 || pg->refcnt != 2 || !proc_pin(p))
+    return 0;
+  pte = walk(p->pagetable, pg->va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || PTE2PA(*pte) != page2pa(pg)){
+    proc_unpin(p);
+    return 0;
+  }
+  return pte;
+}
+
+// pagecache shrinker：丢弃未修改的文件映射页，缺页时会从文件重新读入
+static int
+pagecache_scan(int nr)
+{
+  struct page *victims[RECLAIM_BATCH];
+  int n, freed = 0;
+  pte_t *pte;
+
+  if(nr > RECLAIM_BATCH)
+    nr = RECLAIM_BATCH;
+  n = lru_isolate(PGO_FILE, victims, nr);
+
+  for(int i = 0; i < n; i++){
+    struct page *pg = victims[i];
+    void *pa = (void*)page2pa(pg);
+    struct proc *p;
+
+    push_off();
+    if((pte = lru_mapped_pte(pg)) != 0){
+      p = pg->mapper;
+      if((*pte & PTE_D) == 0){
+        *pte = 0;
+        p->rss--;
+        uvmflush(p, pg->va, 1);
+        kfree(pa);        // 映射的引用
+        freed++;
+      }
+      proc_unpin(p);
+    }
+    pop_off();
+    kfree(pa);            // lru_isolate()的引用
+  }
+  return freed;
+}
+
+static int
+slab_scan(int nr)
+{
+  return kmem_cache_reap(nr);
+}
+
+// ========== 回收 ==========
+
+// 调用各shrinker回收最多nr页，返回回收的页数
+int
+reclaim_pages(int nr)
+{
+  struct shrinker *s;
+  int got = 0;
+
+  if(__sync_lock_test_and_set(&reclaim.running, 1) != 0)
+    return 0;
+  for(s = reclaim.list; s && got < nr; s = s->next){
+    int n = s->scan(nr - got);
+    s->reclaimed += n;
+    got += n;
+  }
+  // 回收的页可能进了本CPU的页缓存，归还伙伴系统
+  kcache_flush();
+  __sync_lock_release(&reclaim.running);
+  return got;
+}
+
+// kalloc()从伙伴系统补充页后调用：低于低水位则唤醒kreclaimd，
+// 低于最低水位则不等kreclaimd，当场同步回收
+void
+reclaim_check(void)
+{
+  uint64 free = buddy_nr_free();
+
+  if(free < wmark.low){
+    acquire(&reclaim.lock);
+    wakeup(&reclaim);
+    release(&reclaim.lock);
+  }
+  if(free < wmark.min)
+    reclaim_direct();
+}
+
+// kalloc()失败时同步回收，返回回收的页数
+int
+reclaim_direct(void)
+{
+  int n;
+
+  if(reclaim.running || wmark.high == 0)
+    return 0;
+  reclaim.direct++;
+  n = reclaim_pages(RECLAIM_BATCH);
+  reclaim.direct_pages += n;
+  return n;
+}
+
+// 回收守护进程：空闲页低于低水位时被唤醒，回收到高水位后睡眠。
+// 检查水位和睡眠之间错过的唤醒无妨，之后补充页时还会再唤醒
+static void
+kreclaimd(void)
+{
+  for(;;){
+    while(buddy_nr_free() < wmark.high){
+      int n = reclaim_pages(RECLAIM_BATCH);
+      reclaim.daemon_pages += n;
+      if(n == 0)
+        break;   // 没有可回收的了
+      yield();
+    }
+    acquire(&reclaim.lock);
+    sleep(&reclaim, &reclaim.lock);
+    reclaim.wakeups++;
+    release(&reclaim.lock);
+  }
+}
+
+// 计算水位，注册内置shrinker，启动kreclaimd。在procinit()之后调用
+void
+reclaim_init(void)
+{
+  initlock(&lru.lock, "lru");
+  initlock(&reclaim.lock, "reclaim");
+
+  wmark.min = npages / 128;
+  wmark.low = npages / 64;
+  wmark.high = npages / 32;
+
+  slab_shrinker.name = "slab";
+  slab_shrinker.scan = slab_scan;
+  register_shrinker(&slab_shrinker);
+  pagecache_shrinker.name = "pagecache";
+  pagecache_shrinker.scan = pagecache_scan;
+  register_shrinker(&pagecache_shrinker);
+
+  if(create_process(kreclaimd, "kreclaimd", MAX_PRIORITY) < 0)
+    panic("reclaim_init");
+}
+
+// 打印回收统计
+void
+reclaim_stats(void)
+{
+  struct shrinker *s;
+
+  printf("\n=== Reclaim ===\n");
+  printf("free=%d pages, watermarks min=%d low=%d high=%d\n",
+         (int)buddy_nr_free(), (int)wmark.min, (int)wmark.low, (int)wmark.high);
+  printf("LRU user pages=%d\n", (int)lru.nr);
+  printf("kreclaimd wakeups=%d reclaimed=%d, direct reclaims=%d reclaimed=%d\n",
+         (int)reclaim.wakeups, (int)reclaim.daemon_pages,
+         (int)reclaim.direct, (int)reclaim.direct_pages);
+  for(s = reclaim.list; s; s = s->next)
+    printf("  shrinker %s: %d pages\n", s->name, (int)s->reclaimed);
+  printf("===============\n\n");
+}
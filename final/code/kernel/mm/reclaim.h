@@ -0,0 +1,27 @@
+// 内存回收
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include "../type.h"
+
+// 可收缩的缓存：内存紧张时由回收器调用scan，要求释放最多nr页
+struct shrinker {
+  char *name;
+  int (*scan)(int nr);       // 返回实际归还给页分配器的页数
+  uint64 reclaimed;          // 累计回收的页数
+  struct shrinker *next;
+};
+
+// 水位（空闲页数）：低于low唤醒kreclaimd，回收到high为止；
+// 低于min时kalloc()当场同步回收
+struct watermarks {
+  uint64 min;
+  uint64 low;
+  uint64 high;
+};
+
+extern struct watermarks wmark;
+
+void register_shrinker(struct shrinker *s);
+
+#endif // RECLAIM_H
@@ -17,6 +17,7 @@ r_mhartid()
 #define MSTATUS_MPP_M (3L << 11)
 #define MSTATUS_MPP_S (1L << 11)
 #define MSTATUS_MPP_U (0L << 11)
+#define MSTATUS_VS_INITIAL (1L << 9) // 打开向量单元（RVV）
 
 static inline uint64
 r_mstatus()
@@ -43,6 +44,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // S模式可访问PTE_U页
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -226,6 +228,12 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// satp的ASID字段（位44..59），地址空间标识，TLB项按它区分
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  0xFFFFL
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -284,6 +292,15 @@ r_time()
   return x;
 }
 
+// 处理器周期计数（需要mcounteren.CY）
+static inline uint64
+r_cycle()
+{
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r" (x) );
+  return x;
+}
+
 // enable device interrupts
 static inline void
 intr_on()
@@ -368,6 +385,27 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// 刷新所有地址空间（含全局映射）中va的TLB项
+static inline void
+sfence_vma_page(uint64 va)
+{
+  asm volatile("sfence.vma %0, zero" : : "r" (va) : "memory");
+}
+
+// 刷新地址空间asid的所有非全局TLB项
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid) : "memory");
+}
+
+// 刷新地址空间asid中va的非全局TLB项
+static inline void
+sfence_vma_page_asid(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid) : "memory");
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -384,6 +422,14 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_G (1L << 5) // 全局映射，存在于所有地址空间，TLB项不按ASID区分
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
+#define PTE_COW (1L << 8) // 写时复制页（RSW位，硬件忽略）
+#define PTE_SHARED (1L << 9) // 共享映射页，fork时不写时复制（RSW位）
+
+// R/W/X任意一位非0即为叶子PTE，否则指向下一级页表
+#define PTE_LEAF(pte) (((pte) & (PTE_R|PTE_W|PTE_X)) != 0)
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -397,6 +443,9 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
 #define PX(level, va) ((((uint64) (va)) >> PXSHIFT(level)) & PXMASK)
 
+// 第level级叶子PTE映射的字节数：4KiB、2MiB、1GiB
+#define LEVELSIZE(level) (1L << PXSHIFT(level))
+
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
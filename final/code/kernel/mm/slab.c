@@ -0,0 +1,257 @@
+// slab分配器：为固定大小的内核对象提供类型化缓存
+//
+// 每个slab是伙伴系统分配的一个 2^order 页的块，块首放置slab头，
+// 其余空间切成等大的对象，空闲对象通过嵌入对象首部的指针串成链表。
+// 由于伙伴块按自身大小对齐，释放时把对象地址向下对齐到块大小
+// 即可找到所属的slab头，无需额外的查找结构。
+//
+// 每个cache维护三个slab链表：partial(部分使用)、full(已满)、
+// empty(全空)。分配优先使用partial，其次empty，最后才向伙伴系统
+// 申请新slab；全空的slab保留在empty链表上，可由kmem_cache_shrink()
+// 归还给伙伴系统。
+
+#include "../type.h"
+#include "../def.h"
+#include "memlayout.h"
+#include "slab.h"
+#include "page.h"
+
+#define SLAB_ALIGN     8     // 对象对齐
+#define SLAB_MIN_OBJS  8     // 每个slab至少容纳的对象数
+#define SLAB_MAX_ORDER 3     // slab最大 8 页
+#define NCACHE         16    // kmem_cache描述符数量
+
+// slab头，位于slab块起始处
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;
+  struct slab *prev;
+  void *freelist;            // 空闲对象链表
+  uint inuse;                // 已分配对象数
+};
+
+// 空闲对象首部的链表指针
+struct slab_obj {
+  struct slab_obj *next;
+};
+
+static struct kmem_cache cache_pool[NCACHE];
+static int ncache;
+static struct kmem_cache *cache_list;
+
+static void
+slab_list_add(struct slab **head, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *head;
+  if(*head)
+    (*head)->prev = s;
+  *head = s;
+}
+
+static void
+slab_list_del(struct slab **head, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *head = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static uint
+slab_hdrsize(void)
+{
+  return (sizeof(struct slab) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+}
+
+// 创建一个对象大小为size的cache
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void *))
+{
+  struct kmem_cache *c;
+  uint hdr = slab_hdrsize();
+
+  if(ncache >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &cache_pool[ncache++];
+
+  if(size < sizeof(struct slab_obj))
+    size = sizeof(struct slab_obj);
+  size = (size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+
+  // 选择能容纳SLAB_MIN_OBJS个对象的最小阶数
+  int order = 0;
+  while(order < SLAB_MAX_ORDER &&
+        ((PGSIZE << order) - hdr) / size < SLAB_MIN_OBJS)
+    order++;
+  if(((PGSIZE << order) - hdr) / size == 0)
+    panic("kmem_cache_create: object too large");
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->objsize = size;
+  c->order = order;
+  c->objs_per_slab = ((PGSIZE << order) - hdr) / size;
+  c->ctor = ctor;
+  c->partial = c->full = c->empty = 0;
+  c->nr_slabs = c->active_objs = c->peak_objs = 0;
+  c->allocs = c->frees = 0;
+
+  c->owner = PGO_SLAB;
+
+  c->next = cache_list;
+  cache_list = c;
+  return c;
+}
+
+// 把cache的slab页计入owner类别，在分配第一个对象之前调用
+void
+kmem_cache_set_owner(struct kmem_cache *c, int owner)
+{
+  if(c->nr_slabs != 0)
+    panic("kmem_cache_set_owner");
+  c->owner = owner;
+}
+
+// 向伙伴系统申请一个新slab并切分成空闲对象。调用者持有c->lock
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc_pages(c->order)) == 0)
+    return 0;
+  page_set_owner(s, c->owner);
+
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  obj = (char*)s + slab_hdrsize();
+  for(uint i = 0; i < c->objs_per_slab; i++, obj += c->objsize){
+    ((struct slab_obj*)obj)->next = s->freelist;
+    s->freelist = obj;
+  }
+  c->nr_slabs++;
+  return s;
+}
+
+// 从cache中分配一个对象，失败返回0
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct slab *s;
+  struct slab_obj *obj;
+
+  acquire(&c->lock);
+  if((s = c->partial) != 0){
+    slab_list_del(&c->partial, s);
+  } else if((s = c->empty) != 0){
+    slab_list_del(&c->empty, s);
+  } else if((s = slab_grow(c)) == 0){
+    release(&c->lock);
+    return 0;
+  }
+
+  obj = s->freelist;
+  s->freelist = obj->next;
+  s->inuse++;
+  if(s->inuse == c->objs_per_slab)
+    slab_list_add(&c->full, s);
+  else
+    slab_list_add(&c->partial, s);
+
+  c->allocs++;
+  c->active_objs++;
+  if(c->active_objs > c->peak_objs)
+    c->peak_objs = c->active_objs;
+  release(&c->lock);
+
+  if(c->ctor)
+    c->ctor(obj);
+  return obj;
+}
+
+// 把对象归还给所属的slab
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+  struct slab_obj *o = (struct slab_obj*)obj;
+
+  s = (struct slab*)((uint64)obj & ~((uint64)(PGSIZE << c->order) - 1));
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+
+  acquire(&c->lock);
+  if(s->inuse == c->objs_per_slab)
+    slab_list_del(&c->full, s);
+  else
+    slab_list_del(&c->partial, s);
+
+  o->next = s->freelist;
+  s->freelist = o;
+  s->inuse--;
+  if(s->inuse == 0)
+    slab_list_add(&c->empty, s);
+  else
+    slab_list_add(&c->partial, s);
+
+  c->frees++;
+  c->active_objs--;
+  release(&c->lock);
+}
+
+// 把cache中完全空闲的slab归还给伙伴系统，返回释放的页数
+int
+kmem_cache_shrink(struct kmem_cache *c)
+{
+  struct slab *s;
+  int freed = 0;
+
+  acquire(&c->lock);
+  while((s = c->empty) != 0){
+    slab_list_del(&c->empty, s);
+    c->nr_slabs--;
+    release(&c->lock);
+    kfree_pages(s, c->order);
+    freed += 1 << c->order;
+    acquire(&c->lock);
+  }
+  release(&c->lock);
+  return freed;
+}
+
+// 收缩所有cache，直到释放了至少nr页，返回释放的页数（供内存回收使用）
+int
+kmem_cache_reap(int nr)
+{
+  struct kmem_cache *c;
+  int freed = 0;
+
+  for(c = cache_list; c && freed < nr; c = c->next)
+    freed += kmem_cache_shrink(c);
+  return freed;
+}
+
+// 打印所有cache的使用统计
+void
+kmem_cache_stats(void)
+{
+  struct kmem_cache *c;
+
+  printf("\n=== Slab Caches ===\n");
+  printf("Name\t\tObjSize\tActive\tTotal\tPeak\tSlabs\tPages\n");
+  for(c = cache_list; c; c = c->next){
+    acquire(&c->lock);
+    printf("%s\t%d\t%d\t%d\t%d\t%d\t%d\n",
+           c->name, c->objsize, (int)c->active_objs,
+           (int)(c->nr_slabs * c->objs_per_slab), (int)c->peak_objs,
+           (int)c->nr_slabs, (int)(c->nr_slabs << c->order));
+    release(&c->lock);
+  }
+  printf("===================\n\n");
+}
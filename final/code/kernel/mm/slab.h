@@ -0,0 +1,42 @@
+// slab对象缓存
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "../type.h"
+#include "../proc/spinlock.h"
+
+struct slab;
+
+// 一类固定大小内核对象的缓存
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint objsize;              // 对齐后的对象大小
+  uint objs_per_slab;        // 每个slab容纳的对象数
+  int order;                 // 每个slab占 2^order 页
+  void (*ctor)(void *);      // 对象构造函数，每次分配时调用，可为0
+  int owner;                 // slab页的所有者类别PGO_*，默认PGO_SLAB
+
+  struct slab *partial;      // 部分空闲的slab
+  struct slab *full;         // 已满的slab
+  struct slab *empty;        // 完全空闲的slab
+
+  // 统计信息
+  uint64 nr_slabs;           // 当前slab数
+  uint64 active_objs;        // 已分配对象数
+  uint64 peak_objs;          // 已分配对象数的峰值
+  uint64 allocs;             // 累计分配次数
+  uint64 frees;              // 累计释放次数
+
+  struct kmem_cache *next;   // 所有cache组成的链表
+};
+
+struct kmem_cache* kmem_cache_create(char *name, uint size, void (*ctor)(void *));
+void               kmem_cache_set_owner(struct kmem_cache *cache, int owner);
+void*              kmem_cache_alloc(struct kmem_cache *cache);
+void               kmem_cache_free(struct kmem_cache *cache, void *obj);
+int                kmem_cache_shrink(struct kmem_cache *cache);
+int                kmem_cache_reap(int nr);
+void               kmem_cache_stats(void);
+
+#endif // SLAB_H
@@ -0,0 +1,221 @@
+// 交换
+//
+// 内存紧张时，swap shrinker从用户页LRU尾部按第二次机会（时钟）算法
+// 挑选最近未被访问的匿名页，保存到一个交换槽后把PTE改为记录槽号的
+// 交换项（V=0）并释放物理页。进程再次访问该页时缺页，vmfault()调用
+// swap_in()读回内容并恢复映射，因此进程的工作集可以超过物理内存。
+//
+// 页先压缩后放入内存中的压缩池（见zram.c），换入只需解压；压缩效果差
+// 或池已满的页留在内存中。块缓存还没有接到磁盘驱动，bread()/bwrite()
+// 只在内存中操作缓冲区，缓冲区随时可能被bget()和bcache shrinker回收，
+// 不能用来保存换出的页，因此没有磁盘交换区。
+// 槽数与物理页数相同，槽表在启动时用vmalloc()分配。
+//
+// fork时交换项随页表复制，槽按引用计数共享，换入时各自读入一份。
+// 只换出唯一映射的匿名页；文件映射页由pagecache shrinker直接丢弃。
+
+#include "../type.h"
+#include "../def.h"
+#include "memlayout.h"
+#include "page.h"
+#include "reclaim.h"
+#include "swap.h"
+#include "zram.h"
+#include "../proc/spinlock.h"
+#include "../proc/proc.h"
+
+struct swap_slot {
+  uint count;                  // 被多少个交换项引用，0为空闲
+  uint zlen;                   // 压缩后的长度
+  void *zobj;                  // 压缩池中的对象
+};
+
+struct {
+  struct spinlock lock;
+  struct swap_slot *slot;
+  int nslot;
+  int hand;                    // 下次从这里开始找空闲槽
+  int used;
+  uint64 outs;                 // 换出的页数
+  uint64 ins;                  // 换入的页数
+  uint64 ticks;                // 换入缺页的累计处理时间
+} swap;
+
+static struct shrinker swap_shrinker;
+
+// 分配一个空闲槽，交换区满时返回-1
+static int
+swap_alloc(void)
+{
+  int slot = -1;
+
+  acquire(&swap.lock);
+  for(int i = 0; i < swap.nslot; i++){
+    int s = (swap.hand + i) % swap.nslot;
+    if(swap.slot[s].count == 0){
+      swap.slot[s].count = 1;
+      swap.hand = (s + 1) % swap.nslot;
+      swap.used++;
+      slot = s;
+      break;
+    }
+  }
+  release(&swap.lock);
+  return slot;
+}
+
+// fork复制了一个交换项。引用计数已到上限时返回-1，fork失败
+int
+swap_dup(int slot)
+{
+  struct swap_slot *s = &swap.slot[slot];
+  int ok;
+
+  acquire(&swap.lock);
+  if(s->count == 0)
+    panic("swap_dup");
+  if((ok = s->count + 1 != 0))
+    s->count++;
+  release(&swap.lock);
+  return ok ? 0 : -1;
+}
+
+// 释放交换项对槽的引用，最后一个引用释放时归还压缩池中的对象
+void
+swap_free(int slot)
+{
+  struct swap_slot *s = &swap.slot[slot];
+  void *zobj = 0;
+  uint zlen = 0;
+
+  acquire(&swap.lock);
+  if(s->count == 0)
+    panic("swap_free");
+  if(--s->count == 0){
+    zobj = s->zobj;
+    zlen = s->zlen;
+    s->zobj = 0;
+    swap.used--;
+  }
+  release(&swap.lock);
+  if(zobj)
+    zram_free(zobj, zlen);
+}
+
+// 把页pa的内容压缩后保存到槽slot。压缩池放不下时返回-1，页留在内存中
+static int
+swap_write(int slot, void *pa)
+{
+  struct swap_slot *s = &swap.slot[slot];
+
+  if((s->zobj = zram_store(pa, &s->zlen)) == 0)
+    return -1;
+  swap.outs++;
+  return 0;
+}
+
+// 从槽slot读回swap_write()保存的一页到pa
+static void
+swap_read(int slot, void *pa)
+{
+  struct swap_slot *s = &swap.slot[slot];
+
+  zram_load(s->zobj, s->zlen, pa);
+}
+
+// 换出lru_isolate()挑出的页pg。保存页的内容和改写PTE期间映射者被
+// lru_mapped_pte()固定，不会运行，页的内容和映射都不会改变；
+// 同时关中断，压缩使用本CPU的缓冲区。
+// 释放lru_isolate()的引用，换出成功返回1。
+static int
+swap_out(struct page *pg)
+{
+  void *pa = (void*)page2pa(pg);
+  struct proc *p;
+  int slot, ok = 0;
+  pte_t *pte;
+
+  push_off();
+  if((pte = lru_mapped_pte(pg)) != 0){
+    p = pg->mapper;
+    if((slot = swap_alloc()) >= 0){
+      if(swap_write(slot, pa) == 0){
+        *pte = SWP_PTE(slot, PTE_FLAGS(*pte));
+        p->rss--;
+        uvmflush(p, pg->va, 1);
+        kfree(pa);        // 映射的引用
+        ok = 1;
+      } else {
+        swap_free(slot);
+      }
+    }
+    proc_unpin(p);
+  }
+  pop_off();
+  kfree(pa);              // lru_isolate()的引用
+  return ok;
+}
+
+// swap shrinker
+static int
+swap_scan(int nr)
+{
+  struct page *victims[SWAP_BATCH];
+  int n, freed = 0;
+
+  if(nr > SWAP_BATCH)
+    nr = SWAP_BATCH;
+  n = lru_isolate(PGO_ANON, victims, nr);
+  for(int i = 0; i < n; i++)
+    freed += swap_out(victims[i]);
+  return freed;
+}
+
+// 处理进程p在va处的交换项pte：读回页的内容并恢复映射。
+// 内存不足返回-1，交换项保持不变。
+int
+swap_in(struct proc *p, uint64 va, pte_t *pte)
+{
+  int slot = SWP_SLOT(*pte);
+  uint64 start = r_time();
+  char *mem;
+
+  // kalloc()可能触发回收，回收只处理有效的PTE，不会改动*pte
+  if((mem = kalloc()) == 0)
+    return -1;
+  swap_read(slot, mem);
+  *pte = PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_V;
+  swap_free(slot);
+  lru_add(mem, p, va, PGO_ANON);
+  p->rss++;
+  p->majflt++;
+  swap.ins++;
+  swap.ticks += r_time() - start;
+  return 0;
+}
+
+// 初始化交换槽和压缩池，注册swap shrinker。在reclaim_init()和vmalloc_init()之后调用
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  swap.nslot = npages;
+  if((swap.slot = vmalloc(swap.nslot * sizeof(struct swap_slot))) == 0)
+    panic("swapinit");
+  memset(swap.slot, 0, swap.nslot * sizeof(struct swap_slot));
+  zram_init();
+
+  swap_shrinker.name = "swap";
+  swap_shrinker.scan = swap_scan;
+  register_shrinker(&swap_shrinker);
+}
+
+// 打印交换统计，换入延迟为每次缺页的平均处理时间（时钟周期）
+void
+swap_stats(void)
+{
+  printf("swap: %d/%d slots used, out=%d in=%d avg fault latency=%d ticks\n",
+         swap.used, swap.nslot, (int)swap.outs, (int)swap.ins,
+         swap.ins ? (int)(swap.ticks / swap.ins) : 0);
+  zram_stats();
+}
@@ -0,0 +1,25 @@
+// 交换：把匿名用户页换出到交换槽，缺页时换入
+#ifndef SWAP_H
+#define SWAP_H
+
+#include "../type.h"
+#include "riscv.h"
+
+struct proc;
+
+#define SWAP_BATCH 16    // swap shrinker每次最多换出的页数
+
+// 被换出的页在PTE中留下一个交换项：V位为0，PPN字段存槽号，
+// 低10位保留原来的权限位（不含V/A/D），换入时恢复
+#define PTE_SWAPPED(pte)    (((pte) & PTE_V) == 0 && (pte) != 0)
+#define SWP_PTE(slot, flags) (((uint64)(slot) << 10) | ((flags) & 0x3FF & ~(PTE_V | PTE_A | PTE_D)))
+#define SWP_SLOT(pte)       ((int)((pte) >> 10))
+
+// swap.c
+void swapinit(void);
+int  swap_in(struct proc *p, uint64 va, pte_t *pte);
+int  swap_dup(int slot);
+void swap_free(int slot);
+void swap_stats(void);
+
+#endif // SWAP_H
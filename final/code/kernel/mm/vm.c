@@ -1,28 +1,59 @@
 #include "../type.h"
 #include "../def.h"
 #include "memlayout.h"
+#include "../boot/fdt.h"
+#include "../proc/proc.h"
+#include "page.h"
+#include "swap.h"
+#include "../proc/spinlock.h"
 
 pagetable_t kernel_pagetable;
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
+// ASID分配：每个进程页表使用一个ASID，切换地址空间时不必刷新TLB。
+// ASID 0留给内核页表。ASID按代分配，一代内每个ASID只分配一次，
+// 用完后进入下一代并刷新整个TLB，进程下次运行时重新分配；
+// 进程退出时ASID随之作废，不会在同一代内被复用，因此释放页表时不必刷新。
+// 进程的p->asid高位记录分配时的代号，低ASID_GEN_SHIFT位为ASID。
+//
+// sfence.vma只刷新本CPU的TLB。每个CPU记录自己刷新到的代，切换到进程时
+// 发现已进入新一代就先刷新整个TLB。进程换到另一个CPU运行，或不在运行时
+// 页表被其他进程（回收、KSM）修改过，切换进来时刷新它的ASID。
+// 不向其他CPU发送刷新请求，因此修改别的进程的页表时要跳过正在运行的进程。
+#define ASID_GEN_SHIFT 16
+#define TLB_FLUSH_MAX  32   // 超过这么多页时刷新整个ASID而不是逐页刷新
+
+struct {
+  struct spinlock lock;
+  int bits;                 // 硬件支持的ASID位数，0表示不支持
+  uint64 gen;               // 当前代，从1开始
+  uint64 next;              // 本代下一个未分配的ASID
+  uint64 rollovers;         // 代更替次数
+} asids;
+
+static int map_range(pagetable_t, uint64, uint64, uint64, int, int);
+static pte_t *walk_level(pagetable_t, uint64, int, int);
+
 pagetable_t
 kvmmake(void)
 {
     //TODO
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
+  kpgtbl = (pagetable_t) kalloc_zeroed();
   // printf("kpgtbl: %x\n", kpgtbl);
-  memset(kpgtbl, 0, PGSIZE);
+
+  // 设备地址来自设备树（见boot/fdt.c）
 
   // uart registers
-  kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, machine.uart_base, machine.uart_base, PGSIZE, PTE_R | PTE_W);
 
   // virtio mmio disk interface
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, machine.virtio_base, machine.virtio_base, PGSIZE, PTE_R | PTE_W);
 
   // PLIC
-  kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
+  kvmmap(kpgtbl, machine.plic_base, machine.plic_base,
+         PGROUNDUP(machine.plic_size), PTE_R | PTE_W);
 
 
   // map kernel text executable and read-only.
@@ -31,14 +62,19 @@ kvmmake(void)
   // map kernel data and the physical RAM we'll make use of.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
+  // vmalloc区的二级页表，进程页表创建时复制指向它的根页表项
+  if(walk_level(kpgtbl, VMALLOC_START, 1, 1) == 0)
+    panic("kvmmake: vmalloc");
   
   return kpgtbl;
 }
 
+// 内核映射在对齐允许时使用1GiB/2MiB大页；
+// 内核映射在所有地址空间中相同，标记为全局
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
+  if(map_range(kpgtbl, va, sz, pa, perm | PTE_G, 1) != 0)
     panic("kvmmap");
 }
 
@@ -46,6 +82,10 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  vmstats(kernel_pagetable, "kernel");
+  initlock(&asids.lock, "asid");
+  asids.gen = 1;
+  asids.next = 1;
 }
 
 // Switch the current CPU's h/w page table register to
@@ -60,23 +100,163 @@ kvminithart()
 
   // flush stale entries from the TLB.
   sfence_vma();
+
+  // 探测ASID位数：向ASID字段写入全1，读回的是实现了的位
+  w_satp(MAKE_SATP_ASID(kernel_pagetable, SATP_ASID_MASK));
+  uint64 mask = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+  w_satp(MAKE_SATP(kernel_pagetable));
+  sfence_vma();
+  for(asids.bits = 0; mask & (1L << asids.bits); asids.bits++)
+    ;
+  printf("ASID bits: %d\n", asids.bits);
+
+  // 此后vfree()释放的页要等本CPU刷新TLB之后才能再分配
+  vmap_flush();
+
+  // 进程以S模式运行，允许访问其用户区（PTE_U）页
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+}
+
+// 返回进程p当前一代的ASID，没有则分配一个。本代用完时进入下一代
+static uint64
+asid_get(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 asid;
+
+  acquire(&asids.lock);
+  if((p->asid >> ASID_GEN_SHIFT) != asids.gen){
+    if(asids.next >= (1L << asids.bits)){
+      asids.gen++;
+      asids.next = 1;
+      asids.rollovers++;
+    }
+    p->asid = (asids.gen << ASID_GEN_SHIFT) | asids.next++;
+  }
+  // 上一代的ASID全部作废，其他CPU各自在下次切换时刷新
+  if(c->asid_gen != asids.gen){
+    sfence_vma();
+    c->asid_gen = asids.gen;
+  }
+  asid = p->asid & ((1L << ASID_GEN_SHIFT) - 1);
+  release(&asids.lock);
+  return asid;
+}
+
+// 切换到进程p的页表。调用时必须关中断。TLB项按ASID区分，通常不必刷新；
+// 硬件不支持ASID时刷新整个TLB
+void
+uvmswitch(struct proc *p)
+{
+  int stale = p->cpu != cpuid() || p->tlb_stale;
+  uint64 asid;
+
+  p->cpu = cpuid();
+  p->tlb_stale = 0;
+  if(asids.bits == 0){
+    sfence_vma();
+    w_satp(MAKE_SATP(p->pagetable));
+    sfence_vma();
+    return;
+  }
+  asid = asid_get(p);
+  if(stale)
+    sfence_vma_asid(asid);
+  w_satp(MAKE_SATP_ASID(p->pagetable, asid));
+}
+
+// 切换回内核页表（ASID 0）。内核映射是全局的，不必刷新
+void
+kvmswitch(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable));
+  if(asids.bits == 0)
+    sfence_vma();
+}
+
+// 进程p的页表中 [va, va+npages*PGSIZE) 的映射被修改或解除后刷新TLB，
+// 只刷新p的ASID；npages为0或较大时刷新p的整个ASID
+void
+uvmflush(struct proc *p, uint64 va, uint64 npages)
+{
+  uint64 asid;
+
+  push_off();
+  if(asids.bits == 0){
+    if(p != myproc())
+      p->tlb_stale = 1;
+    sfence_vma();
+    pop_off();
+    return;
+  }
+  if(p == myproc()){
+    // 正在本CPU上运行：其他CPU可能已进入下一代，p->asid的代号不能说明
+    // TLB中没有它的表项，按satp中实际使用的ASID刷新
+    asid = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+  } else {
+    // 不在运行（已被固定）：上次运行的CPU上可能还有旧的表项，切换进来时刷新。
+    // 自上次代更替以来没有运行过的进程在本CPU的TLB中没有表项
+    p->tlb_stale = 1;
+    if((p->asid >> ASID_GEN_SHIFT) != asids.gen){
+      pop_off();
+      return;
+    }
+    asid = p->asid & ((1L << ASID_GEN_SHIFT) - 1);
+  }
+  if(npages == 0 || npages > TLB_FLUSH_MAX)
+    sfence_vma_asid(asid);
+  else
+    for(uint64 i = 0; i < npages; i++)
+      sfence_vma_page_asid(va + i * PGSIZE, asid);
+  pop_off();
 }
 
 pagetable_t
 create_pagetable()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
+// 以4KiB页建立映射（用户页表使用）
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  return map_range(pagetable, va, size, pa, perm, 0);
+}
+
+// 返回va在第level级页表中的PTE地址，必要时分配中间页表。
+// 途中遇到更大的叶子页时返回0。
+static pte_t *
+walk_level(pagetable_t pagetable, uint64 va, int level, int alloc)
+{
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return 0;
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+        return 0;
+      page_set_owner(pagetable, PGO_PAGETABLE);
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(level, va)];
+}
+
+// 把[va, va+size)映射到[pa, pa+size)。
+// huge非0时，va和pa都按1GiB/2MiB对齐且剩余长度足够的部分使用大页；
+// 其余部分使用4KiB页，每取得一个叶子页表就连续填充到2MiB边界，
+// 而不是每一页都从根页表重新遍历。
+static int
+map_range(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm, int huge)
+{
+  uint64 end;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
@@ -87,23 +267,45 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 
   if(size == 0)
     panic("mappages: size");
-  
-  a = va;
-  last = va + size - PGSIZE;
-  for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+
+  end = va + size;
+  while(va < end){
+    int level = 0;
+    if(huge){
+      for(level = 2; level > 0; level--){
+        uint64 sz = LEVELSIZE(level);
+        if(va % sz == 0 && pa % sz == 0 && end - va >= sz)
+          break;
+      }
+    }
+
+    if(level > 0){
+      if((pte = walk_level(pagetable, va, level, 1)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        panic("mappages: remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      va += LEVELSIZE(level);
+      pa += LEVELSIZE(level);
+      continue;
+    }
+
+    // 填充当前叶子页表，直到区间结束或到达2MiB边界
+    uint64 stop = (va + LEVELSIZE(1)) & ~(LEVELSIZE(1) - 1);
+    if(stop > end)
+      stop = end;
+    if((pte = walk_level(pagetable, va, 0, 1)) == 0)
       return -1;
-    if(*pte & PTE_V)
-      panic("mappages: remap");
-    *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
-      break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    for(; va < stop; va += PGSIZE, pa += PGSIZE, pte++){
+      if(*pte & PTE_V)
+        panic("mappages: remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+    }
   }
   return 0;
 }
 
+// 返回va对应的PTE地址。若va被大页映射，返回该大页的叶子PTE。
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
@@ -113,11 +315,13 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
+      page_set_owner(pagetable, PGO_PAGETABLE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -147,20 +351,320 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
+// 待释放页的批次：凑满FREE_BATCH页后一次交给kfree_batch()。
+// p非0时，页归还之前先刷新p的TLB，保证没有TLB项还指向已释放的页。
+#define FREE_BATCH 64
+
+struct freebatch {
+  struct proc *p;
+  int n;
+  void *pa[FREE_BATCH];
+};
+
+static void
+fb_flush(struct freebatch *fb)
+{
+  if(fb->n == 0)
+    return;
+  if(fb->p)
+    uvmflush(fb->p, 0, 0);
+  kfree_batch(fb->pa, fb->n);
+  fb->n = 0;
+}
+
+static void
+fb_add(struct freebatch *fb, void *pa)
+{
+  fb->pa[fb->n++] = pa;
+  if(fb->n == FREE_BATCH)
+    fb_flush(fb);
+}
+
+// ========== 进程地址空间 ==========
+//
+// 进程页表的根页表中，0号表项指向进程私有的二级页表，
+// 其覆盖的 [0, USERTOP) 为用户区；其余根表项、以及0号二级页表中
+// USERTOP之上的设备映射都直接复制自内核页表，指向内核的页表页，
+// 因此进程运行时仍能访问内核和设备，且这些页表页不随进程释放。
+
+#define USER_L1_END PX(1, USERTOP)  // 0号二级页表中用户区表项的上界
+
+// 创建进程页表，返回0表示内存不足
+pagetable_t
+uvmcreate(void)
+{
+  pagetable_t pagetable, l1, kl1;
+
+  if((pagetable = (pagetable_t)kalloc_zeroed()) == 0)
+    return 0;
+  if((l1 = (pagetable_t)kalloc_zeroed()) == 0){
+    kfree(pagetable);
+    return 0;
+  }
+  page_set_owner(pagetable, PGO_PAGETABLE);
+  page_set_owner(l1, PGO_PAGETABLE);
+
+  for(int i = 1; i < 512; i++)
+    pagetable[i] = kernel_pagetable[i];
+  pagetable[0] = PA2PTE(l1) | PTE_V;
+
+  if(kernel_pagetable[0] & PTE_V){
+    kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+    for(int i = 0; i < 512; i++){
+      if(i < USER_L1_END && (kl1[i] & PTE_V))
+        panic("uvmcreate: kernel mapping in user range");
+      if(i >= USER_L1_END)
+        l1[i] = kl1[i];
+    }
+  }
+  return pagetable;
+}
+
+// 释放进程页表：用户区中所有已映射的页（共享页只递减引用计数）
+// 以及进程私有的页表页。只进入存在的叶子页表，页按批归还分配器。
+// 进程的ASID随之作废，不必刷新TLB。
 void
-free_pagetable(pagetable_t pagetable)
+uvmfree(pagetable_t pagetable)
+{
+  pagetable_t l1 = (pagetable_t)PTE2PA(pagetable[0]);
+  struct freebatch fb = { 0 };
+
+  for(int i = 0; i < USER_L1_END; i++){
+    if((l1[i] & PTE_V) == 0)
+      continue;
+    pagetable_t l0 = (pagetable_t)PTE2PA(l1[i]);
+    for(int j = 0; j < 512; j++){
+      if(l0[j] & PTE_V)
+        fb_add(&fb, (void*)PTE2PA(l0[j]));
+      else if(PTE_SWAPPED(l0[j]))
+        swap_free(SWP_SLOT(l0[j]));
+    }
+    fb_add(&fb, l0);
+    l1[i] = 0;
+  }
+  fb_add(&fb, l1);
+  fb_add(&fb, pagetable);
+  fb_flush(&fb);
+}
+
+// fork时复制父进程的用户区：不复制页的内容，父子进程映射同一物理页，
+// 可写页在双方都改为只读并标记PTE_COW，等到写入时再由vmfault()复制；
+// 共享映射的页(PTE_SHARED)保持可写，父子进程继续共享；
+// 已换出的页复制交换项，换入时各自读回一份。
+// 开销只与已映射的页数成正比。失败时返回-1，已建立的映射由调用者释放。
+int
+uvmcopy(struct proc *p, pagetable_t new)
+{
+  pagetable_t ol1 = (pagetable_t)PTE2PA(p->pagetable[0]);
+  pagetable_t nl1 = (pagetable_t)PTE2PA(new[0]);
+  int shared = 0;
+
+  for(int i = 0; i < USER_L1_END; i++){
+    if((ol1[i] & PTE_V) == 0)
+      continue;
+    pagetable_t ol0 = (pagetable_t)PTE2PA(ol1[i]);
+    pagetable_t nl0 = (pagetable_t)kalloc_zeroed();
+    if(nl0 == 0)
+      goto fail;
+    page_set_owner(nl0, PGO_PAGETABLE);
+    nl1[i] = PA2PTE(nl0) | PTE_V;
+
+    for(int j = 0; j < 512; j++){
+      pte_t pte = ol0[j];
+      if(PTE_SWAPPED(pte)){
+        if(swap_dup(SWP_SLOT(pte)) < 0)
+          goto fail;
+        nl0[j] = pte;
+        continue;
+      }
+      if((pte & PTE_V) == 0)
+        continue;
+      if((pte & PTE_W) && (pte & PTE_SHARED) == 0){
+        pte = (pte & ~PTE_W) | PTE_COW;
+        ol0[j] = pte;
+        shared = 1;
+      }
+      kref_get((void*)PTE2PA(pte));
+      nl0[j] = pte;
+    }
+  }
+
+  // 父进程的可写页刚改为只读，丢弃TLB中的旧表项
+  if(shared)
+    uvmflush(p, 0, 0);
+  return 0;
+
+ fail:
+  if(shared)
+    uvmflush(p, 0, 0);
+  return -1;
+}
+
+// 解除 [va, va+npages*PGSIZE) 中已建立的映射并释放页（已换出的页释放页槽），
+// 跳过整个不存在的叶子页表，整个被解除的叶子页表也一并释放。
+// 页按批归还分配器，每批之前刷新TLB。返回解除映射的驻留页数。
+static uint64
+uvmunmap(struct proc *p, uint64 va, uint64 npages)
+{
+  pagetable_t pagetable = p->pagetable;
+  uint64 start = va, end = va + npages * PGSIZE;
+  struct freebatch fb = { .p = p };
+  uint64 n = 0;
+
+  while(va < end){
+    uint64 next = (va + LEVELSIZE(1)) & ~(LEVELSIZE(1) - 1);
+    uint64 stop = next < end ? next : end;
+    pte_t *l1pte = walk_level(pagetable, va, 1, 0);
+    if(l1pte == 0 || (*l1pte & PTE_V) == 0){
+      va = next;
+      continue;
+    }
+
+    pagetable_t l0 = (pagetable_t)PTE2PA(*l1pte);
+    for(pte_t *pte = &l0[PX(0, va)]; va < stop; va += PGSIZE, pte++){
+      if(*pte & PTE_V){
+        fb_add(&fb, (void*)PTE2PA(*pte));
+        n++;
+      } else if(PTE_SWAPPED(*pte)){
+        swap_free(SWP_SLOT(*pte));
+      }
+      *pte = 0;
+    }
+
+    // 整个2MiB都被解除：叶子页表已空
+    if(stop == next && start <= next - LEVELSIZE(1)){
+      *l1pte = 0;
+      fb_add(&fb, l0);
+    }
+  }
+  if(n || fb.n){
+    uvmflush(p, start, npages);
+    fb.p = 0;   // 已刷新
+  }
+  fb_flush(&fb);
+  return n;
+}
+
+// 把进程的用户区从oldsz缩小到newsz，释放其间已分配的页，返回newsz
+uint64
+uvmdealloc(struct proc *p, uint64 oldsz, uint64 newsz)
+{
+  if(newsz >= oldsz)
+    return oldsz;
+
+  if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    uint64 npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
+    p->rss -= uvmunmap(p, PGROUNDUP(newsz), npages);
+  }
+  return newsz;
+}
+
+// 处理进程p用户区va处的缺页，write表示写访问：
+//   映射区（包括exec装入的程序段）中尚未映射的页：由mmap_fault()读入文件内容
+//   堆中尚未映射的页：分配一个清零页（sbrk只扩大p->sz，不分配内存）
+//   已换出的页：由swap_in()从交换区读回
+//   写时复制页：复制或恢复写权限
+// 成功返回0，非法访问或内存不足返回-1。
+int
+vmfault(struct proc *p, uint64 va, int write)
+{
+  pagetable_t pagetable = p->pagetable;
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+  int r;
+
+  if(va >= USERTOP)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+
+  // 换入后如果是对写时复制页的写入，继续按写时复制处理
+  if(pte && PTE_SWAPPED(*pte) && swap_in(p, va, pte) != 0)
+    return -1;
+
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if((r = mmap_fault(p, va, write)) != 1)
+      return r;
+    if(va < p->heapbase || va >= p->sz)
+      return -1;
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R | PTE_W | PTE_U) != 0){
+      kfree(mem);
+      return -1;
+    }
+    lru_add(mem, p, va, PGO_ANON);
+    p->rss++;
+    p->minflt++;
+    return 0;
+  }
+
+  if(!write || (*pte & PTE_W))
+    return 0;   // 其他CPU已处理，TLB中是旧表项
+  if((*pte & PTE_COW) == 0)
+    return -1;
+
+  // 写时复制：只剩一个引用时直接恢复写权限，否则复制一份
+  pa = PTE2PA(*pte);
+  if(kref_count((void*)pa) == 1){
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+    lru_add((void*)pa, p, va, pa2page(pa)->owner);  // 现在由p独占
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (void*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | ((PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W);
+    kfree((void*)pa);
+    lru_add(mem, p, va, PGO_ANON);
+  }
+  p->cowflt++;
+  uvmflush(p, va, 1);
+  return 0;
+}
+
+// 页表规模统计
+struct ptstats {
+  uint64 tables[3];   // 各级页表页数（下标为级别）
+  uint64 leaves[3];   // 各级叶子PTE数：0=4KiB, 1=2MiB, 2=1GiB
+};
+
+static void
+ptcount(pagetable_t pagetable, int level, struct ptstats *st)
 {
-  // there are 2^9 = 512 PTEs in a page table.
+  st->tables[level]++;
   for(int i = 0; i < 512; i++){
     pte_t pte = pagetable[i];
-    if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
-      // this PTE points to a lower-level page table.
-      uint64 child = PTE2PA(pte);
-      free_pagetable((pagetable_t)child);
-      pagetable[i] = 0;
-    } else if(pte & PTE_V){
-      panic("free_pagetable: leaf");
-    }
+    if((pte & PTE_V) == 0)
+      continue;
+    if(PTE_LEAF(pte))
+      st->leaves[level]++;
+    else if(level > 0)
+      ptcount((pagetable_t)PTE2PA(pte), level - 1, st);
   }
-  kfree((void*)pagetable);
-}
\ No newline at end of file
+}
+
+// 打印页表使用的页表页和PTE数量，并与全部使用4KiB页时的开销对比。
+// 4KiB对照值由实际页表推出：每个2MiB大页需要一个叶子页表和512个PTE，
+// 每个1GiB大页需要一个二级页表、512个叶子页表和512*512个PTE。
+void
+vmstats(pagetable_t pagetable, char *name)
+{
+  struct ptstats st;
+  uint64 tables, ptes, tables4k, ptes4k;
+
+  memset(&st, 0, sizeof(st));
+  ptcount(pagetable, 2, &st);
+
+  tables = st.tables[2] + st.tables[1] + st.tables[0];
+  ptes = st.leaves[0] + st.leaves[1] + st.leaves[2];
+  tables4k = st.tables[2] + (st.tables[1] + st.leaves[2])
+           + (st.tables[0] + st.leaves[1] + 512 * st.leaves[2]);
+  ptes4k = st.leaves[0] + 512 * st.leaves[1] + 512 * 512 * st.leaves[2];
+
+  printf("%s page table: %d table pages, %d leaf PTEs (4K=%d, 2M=%d, 1G=%d)\n",
+         name, (int)tables, (int)ptes, (int)st.leaves[0],
+         (int)st.leaves[1], (int)st.leaves[2]);
+  printf("  with 4K pages only: %d table pages, %d leaf PTEs\n",
+         (int)tables4k, (int)ptes4k);
+}
@@ -0,0 +1,247 @@
+// 虚拟连续的内核内存分配
+//
+// vmalloc(size)从伙伴系统逐页分配物理页，映射到内核虚拟地址区
+// [VMALLOC_START, VMALLOC_END) 中一段连续的地址上，适合物理上不必连续、
+// 大小在运行时才确定的大型内核表。每个分配区之后留一个不映射的保护页，
+// 越界访问会触发缺页而不是悄悄破坏相邻的分配。
+//
+// 该区的二级页表在kvmmake()中预先分配，进程页表在创建时复制根页表项，
+// 因此之后建立的映射对所有进程页表立即可见。相邻的分配区共用末级页表，
+// 建立和解除映射都持有vmap.lock。
+// 分配区按地址排序放在链表中，首次适配查找空闲地址。
+//
+// 映射是全局的(PTE_G)，其他CPU的TLB中可能还有已释放分配区的表项，
+// 而这里没有跨CPU刷新TLB的手段。因此vfree()解除映射后，分配区连同它的页
+// 先留在链表中（地址区间仍被占用），标上释放时的代号；各CPU在时钟中断中
+// 发现代号更新就刷新整个TLB（vmap_flush）。所有启用了分页的CPU都刷新过
+// 之后，页才归还分配器，地址区间才能再分配出去。
+
+#include "../type.h"
+#include "../def.h"
+#include "memlayout.h"
+#include "page.h"
+#include "slab.h"
+#include "../proc/spinlock.h"
+#include "../proc/proc.h"
+
+// 一个分配区：[start, start + npages*PGSIZE)，其后是一个保护页
+struct vm_area {
+  uint64 start;
+  uint64 npages;
+  uint64 freegen;            // 已释放、等待各CPU刷新TLB时为释放时的代号，否则为0
+  struct page *freed;        // 已解除映射的页，用page->next串起
+  struct vm_area *next;
+};
+
+#define VMA_SPAN(a) (((a)->npages + 1) * PGSIZE)   // 含保护页
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct vm_area *areas;     // 按起始地址排序
+  uint64 nareas;
+  uint64 pages;              // 已映射的页数
+  uint64 lazy;               // 已解除映射、等待各CPU刷新TLB的页数
+  uint64 gen;                // 最近一次vfree()的代号
+  uint64 flushed[NCPU];      // 各CPU刷新TLB时看到的代号
+  uint active;               // 已启用分页、需要等它刷新TLB的CPU（位图）
+} vmap;
+
+void
+vmalloc_init(void)
+{
+  initlock(&vmap.lock, "vmalloc");
+  vmap.cache = kmem_cache_create("vm_area", sizeof(struct vm_area), 0);
+}
+
+// 返回va的PTE。末级页表不存在时用*spare补上并把*spare置0；
+// *spare也为0时返回0。调用者持有vmap.lock
+static pte_t*
+vmap_pte(uint64 va, void **spare)
+{
+  pagetable_t l1 = (pagetable_t)PTE2PA(kernel_pagetable[PX(2, va)]);
+  pte_t *pde = &l1[PX(1, va)];
+
+  if((*pde & PTE_V) == 0){
+    if(*spare == 0)
+      return 0;
+    page_set_owner(*spare, PGO_PAGETABLE);
+    *pde = PA2PTE(*spare) | PTE_V;
+    *spare = 0;
+  }
+  return &((pagetable_t)PTE2PA(*pde))[PX(0, va)];
+}
+
+// 解除分配区a的映射，把页挂到a->freed上，只刷新本CPU的TLB。调用者持有vmap.lock
+static void
+vunmap(struct vm_area *a)
+{
+  uint64 va = a->start;
+  struct page *pg;
+  pte_t *pte;
+
+  for(uint64 i = 0; i < a->npages; i++, va += PGSIZE){
+    if((pte = walk(kernel_pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    pg = pa2page(PTE2PA(*pte));
+    *pte = 0;
+    sfence_vma_page(va);   // 全局映射，刷新所有地址空间
+    pg->next = a->freed;
+    a->freed = pg;
+    vmap.pages--;
+    __sync_fetch_and_add(&vmap.lazy, 1);
+  }
+}
+
+// 所有启用了分页的CPU都已刷新过TLB的已释放分配区从链表中摘下，串到*done上，
+// 由调用者在放锁后用vmap_release()释放。调用者持有vmap.lock
+static void
+vmap_purge(struct vm_area **done)
+{
+  struct vm_area *a, **pp;
+  uint64 seen = vmap.gen;
+
+  for(int i = 0; i < NCPU; i++)
+    if((vmap.active & (1U << i)) && vmap.flushed[i] < seen)
+      seen = vmap.flushed[i];
+  for(pp = &vmap.areas; (a = *pp) != 0; ){
+    if(a->freegen != 0 && a->freegen <= seen){
+      *pp = a->next;
+      vmap.nareas--;
+      a->next = *done;
+      *done = a;
+    } else {
+      pp = &a->next;
+    }
+  }
+}
+
+// 把vmap_purge()摘下的分配区的页还给分配器
+static void
+vmap_release(struct vm_area *done)
+{
+  struct vm_area *a;
+  struct page *pg;
+
+  while((a = done) != 0){
+    done = a->next;
+    while((pg = a->freed) != 0){
+      a->freed = pg->next;
+      pg->next = 0;
+      kfree((void*)page2pa(pg));
+      __sync_fetch_and_sub(&vmap.lazy, 1);
+    }
+    kmem_cache_free(vmap.cache, a);
+  }
+}
+
+// 时钟中断中调用：有分配区被释放时刷新本CPU的整个TLB，记下看到的代号。
+// kvminithart()中第一次调用，此后vfree()的页要等本CPU刷新过才能再分配
+void
+vmap_flush(void)
+{
+  int id = cpuid();
+  uint64 gen = vmap.gen;
+
+  if((vmap.active & (1U << id)) && vmap.flushed[id] == gen)
+    return;
+  __sync_synchronize();
+  sfence_vma();
+  vmap.flushed[id] = gen;
+  __sync_fetch_and_or(&vmap.active, 1U << id);
+}
+
+// 分配size字节虚拟连续的内核内存，内容未初始化。失败返回0
+void*
+vmalloc(uint64 size)
+{
+  struct vm_area *a, **pp, *done = 0;
+  uint64 npages = PGROUNDUP(size) / PGSIZE;
+  uint64 va, need;
+  void *mem, *spare = 0;
+  pte_t *pte;
+
+  if(npages == 0 || (a = kmem_cache_alloc(vmap.cache)) == 0)
+    return 0;
+  need = (npages + 1) * PGSIZE;
+
+  // 首次适配；区首留一个保护页
+  acquire(&vmap.lock);
+  vmap_purge(&done);
+  va = VMALLOC_START + PGSIZE;
+  for(pp = &vmap.areas; *pp; pp = &(*pp)->next){
+    if((*pp)->start - va >= need)
+      break;
+    va = (*pp)->start + VMA_SPAN(*pp);
+  }
+  if(va + need > VMALLOC_END){
+    release(&vmap.lock);
+    vmap_release(done);
+    kmem_cache_free(vmap.cache, a);
+    return 0;
+  }
+  a->start = va;
+  a->npages = npages;
+  a->freegen = 0;
+  a->freed = 0;
+  a->next = *pp;
+  *pp = a;
+  vmap.nareas++;
+  release(&vmap.lock);
+  vmap_release(done);
+
+  // 分配内存可能进入回收，因此在放锁时分配页和末级页表
+  for(uint64 i = 0; i < npages; i++){
+    if((mem = kalloc()) == 0)
+      goto fail;
+    page_set_owner(mem, PGO_VMALLOC);
+    acquire(&vmap.lock);
+    while((pte = vmap_pte(va + i * PGSIZE, &spare)) == 0){
+      release(&vmap.lock);
+      if((spare = kalloc_zeroed()) == 0){
+        kfree(mem);
+        goto fail;
+      }
+      acquire(&vmap.lock);
+    }
+    *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_G | PTE_V;
+    vmap.pages++;
+    release(&vmap.lock);
+  }
+  if(spare)
+    kfree(spare);
+  return (void*)va;
+
+ fail:
+  vfree((void*)va);
+  return 0;
+}
+
+// 释放vmalloc()返回的内存。页和地址区间在各CPU刷新TLB之后才能再分配
+void
+vfree(void *addr)
+{
+  struct vm_area *a, *done = 0;
+
+  if(addr == 0)
+    return;
+  acquire(&vmap.lock);
+  for(a = vmap.areas; a != 0; a = a->next)
+    if(a->start == (uint64)addr && a->freegen == 0)
+      break;
+  if(a == 0)
+    panic("vfree");
+  vunmap(a);
+  a->freegen = ++vmap.gen;
+  vmap_purge(&done);
+  release(&vmap.lock);
+  vmap_release(done);
+}
+
+void
+vmalloc_stats(void)
+{
+  printf("vmalloc: %d areas, %d pages mapped, %d pages awaiting TLB flush (region %d MiB)\n",
+         (int)vmap.nareas, (int)vmap.pages, (int)vmap.lazy,
+         (int)((VMALLOC_END - VMALLOC_START) >> 20));
+}
@@ -0,0 +1,269 @@
+// 压缩内存交换层
+//
+// 换出的匿名页先用LZ类压缩算法压缩后保存在内存池中，换入时解压，
+// 不经过块设备。压缩后不超过ZRAM_MAXLEN字节的页按长度放入几个
+// 大小类的slab cache，全零页只记一个标记；压缩效果差的页或池已满时
+// 留在内存中，不换出。池最多占用物理内存的1/ZRAM_POOL_DIV。
+//
+// 压缩格式与LZ4块格式类似，由若干序列组成：
+//   token  高4位为字面量长度，低4位为匹配长度-4，取15时后跟扩展长度字节
+//   字面量
+//   offset 2字节小端，匹配串在输出中向前的距离
+// 最后一个序列只有字面量。一页内的偏移不超过4095，2字节足够。
+
+#include "../type.h"
+#include "../def.h"
+#include "memlayout.h"
+#include "page.h"
+#include "slab.h"
+#include "zram.h"
+#include "../proc/proc.h"
+
+#define ZRAM_POOL_DIV 4      // 池大小上限：物理内存的1/4
+#define LZ_HASHBITS   10
+#define LZ_MINMATCH   4
+
+// 压缩数据的大小类
+static const uint zram_sizes[] = { 256, 512, 1024, 1536, 2048, 3072 };
+static char *zram_names[] = {
+  "zram-256", "zram-512", "zram-1024", "zram-1536", "zram-2048", "zram-3072"
+};
+#define NZCLASS (sizeof(zram_sizes) / sizeof(zram_sizes[0]))
+
+struct {
+  struct kmem_cache *class[NZCLASS];
+  uint64 max_pages;          // 池占用页数上限
+  uint64 stored;             // 池中保存的页数（不含全零页）
+  uint64 zero;               // 全零页数
+  uint64 bytes;              // 池中压缩数据的总字节数
+  uint64 rejects;            // 压缩效果差而拒绝的页数
+  uint64 full;               // 池满而拒绝的页数
+} zram;
+
+// 每个CPU的压缩哈希表和输出缓冲区，调用者关中断
+static ushort lz_table[NCPU][1 << LZ_HASHBITS];
+static uchar lz_buf[NCPU][ZRAM_MAXLEN];
+
+static inline uint
+lz_read32(const uchar *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint)p[3] << 24;
+}
+
+static uchar*
+lz_putlen(uchar *op, uint len)
+{
+  if(len >= 15){
+    len -= 15;
+    for(; len >= 255; len -= 255)
+      *op++ = 255;
+    *op++ = len;
+  }
+  return op;
+}
+
+static uint
+lz_getlen(const uchar **ip)
+{
+  uint len = 0, b;
+
+  do {
+    b = *(*ip)++;
+    len += b;
+  } while(b == 255);
+  return len;
+}
+
+// 输出一个序列：anchor起lit字节字面量，随后（off非0时）一个匹配
+static uchar*
+lz_emit(uchar *op, const uchar *anchor, uint lit, uint off, uint mlen)
+{
+  uchar *tok = op++;
+
+  *tok = (lit < 15 ? lit : 15) << 4;
+  op = lz_putlen(op, lit);
+  memmove(op, anchor, lit);
+  op += lit;
+  if(off){
+    *tok |= mlen < 15 ? mlen : 15;
+    *op++ = off;
+    *op++ = off >> 8;
+    op = lz_putlen(op, mlen);
+  }
+  return op;
+}
+
+// 把一页src压缩到dst，输出超过cap字节时放弃并返回0
+static int
+lz_compress(const uchar *src, uchar *dst, int cap, ushort *table)
+{
+  const uchar *ip = src, *anchor = src, *end = src + PGSIZE;
+  const uchar *mlimit = end - LZ_MINMATCH;
+  uchar *op = dst;
+  uint lit;
+
+  memset(table, 0, sizeof(lz_table[0]));
+  while(ip <= mlimit){
+    uint seq = lz_read32(ip);
+    uint h = (seq * 2654435761U) >> (32 - LZ_HASHBITS);
+    const uchar *ref = src + table[h];
+    table[h] = ip - src;
+    if(ref >= ip || lz_read32(ref) != seq){
+      ip++;
+      continue;
+    }
+
+    const uchar *mp = ip + LZ_MINMATCH, *rp = ref + LZ_MINMATCH;
+    while(mp < end && *mp == *rp){
+      mp++;
+      rp++;
+    }
+
+    // 最坏情况：token + 扩展长度 + 字面量 + offset
+    lit = ip - anchor;
+    if((op - dst) + 1 + lit / 255 + 1 + lit + 2 + (mp - ip) / 255 + 1 > cap)
+      return 0;
+    op = lz_emit(op, anchor, lit, ip - ref, mp - ip - LZ_MINMATCH);
+    ip = anchor = mp;
+  }
+
+  lit = end - anchor;
+  if((op - dst) + 1 + lit / 255 + 1 + lit > cap)
+    return 0;
+  op = lz_emit(op, anchor, lit, 0, 0);
+  return op - dst;
+}
+
+// 把lz_compress()的输出src（n字节）解压为一页dst
+static void
+lz_decompress(const uchar *src, int n, uchar *dst)
+{
+  const uchar *ip = src, *iend = src + n;
+  uchar *op = dst;
+
+  while(ip < iend){
+    uint tok = *ip++;
+    uint lit = tok >> 4;
+    if(lit == 15)
+      lit += lz_getlen(&ip);
+    memmove(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if(ip >= iend)
+      break;    // 最后一个序列
+
+    uint off = ip[0] | ip[1] << 8;
+    ip += 2;
+    uint mlen = tok & 15;
+    if(mlen == 15)
+      mlen += lz_getlen(&ip);
+    mlen += LZ_MINMATCH;
+
+    // 匹配串可能与输出重叠，逐字节复制
+    const uchar *ref = op - off;
+    while(mlen--)
+      *op++ = *ref++;
+  }
+}
+
+static int
+zram_class(uint len)
+{
+  for(int i = 0; i < NZCLASS; i++)
+    if(len <= zram_sizes[i])
+      return i;
+  panic("zram_class");
+  return -1;
+}
+
+static uint64
+zram_pool_pages(void)
+{
+  uint64 n = 0;
+
+  for(int i = 0; i < NZCLASS; i++)
+    n += zram.class[i]->nr_slabs << zram.class[i]->order;
+  return n;
+}
+
+void
+zram_init(void)
+{
+  for(int i = 0; i < NZCLASS; i++)
+    zram.class[i] = kmem_cache_create(zram_names[i], zram_sizes[i], 0);
+  zram.max_pages = npages / ZRAM_POOL_DIV;
+}
+
+// 压缩保存页pa，返回池中的对象（全零页返回ZRAM_ZERO），*len为压缩后的长度。
+// 压缩效果差或池已满时返回0。调用者关中断。
+void*
+zram_store(void *pa, uint *len)
+{
+  uint64 *w = (uint64*)pa;
+  int c, n, i;
+  void *obj;
+
+  for(i = 0; i < PGSIZE / sizeof(uint64) && w[i] == 0; i++)
+    ;
+  if(i == PGSIZE / sizeof(uint64)){
+    zram.zero++;
+    *len = 0;
+    return ZRAM_ZERO;
+  }
+
+  n = lz_compress(pa, lz_buf[cpuid()], ZRAM_MAXLEN, lz_table[cpuid()]);
+  if(n == 0){
+    zram.rejects++;
+    return 0;
+  }
+  c = zram_class(n);
+  if(zram_pool_pages() >= zram.max_pages ||
+     (obj = kmem_cache_alloc(zram.class[c])) == 0){
+    zram.full++;
+    return 0;
+  }
+  memmove(obj, lz_buf[cpuid()], n);
+  zram.stored++;
+  zram.bytes += n;
+  *len = n;
+  return obj;
+}
+
+// 把zram_store()保存的对象解压到页pa
+void
+zram_load(void *obj, uint len, void *pa)
+{
+  if(obj == ZRAM_ZERO)
+    memset(pa, 0, PGSIZE);
+  else
+    lz_decompress(obj, len, pa);
+}
+
+void
+zram_free(void *obj, uint len)
+{
+  if(obj == ZRAM_ZERO){
+    zram.zero--;
+    return;
+  }
+  kmem_cache_free(zram.class[zram_class(len)], obj);
+  zram.stored--;
+  zram.bytes -= len;
+}
+
+// 打印压缩池统计：池比率为保存的页数与池占用页数之比
+void
+zram_stats(void)
+{
+  uint64 pool = zram_pool_pages();
+  uint64 r100 = (zram.stored + zram.zero) * 100 / (pool ? pool : 1);
+
+  printf("zram: %d pages stored (+%d zero) in %d pool pages (max %d)\n",
+         (int)zram.stored, (int)zram.zero, (int)pool, (int)zram.max_pages);
+  if(zram.stored)
+    printf("  compressed size %d%% of original, pool ratio %d.%d%d:1\n",
+           (int)(zram.bytes * 100 / (zram.stored * PGSIZE)),
+           (int)(r100 / 100), (int)(r100 / 10 % 10), (int)(r100 % 10));
+  printf("  rejected: incompressible=%d pool full=%d\n",
+         (int)zram.rejects, (int)zram.full);
+}
@@ -0,0 +1,17 @@
+// 压缩内存交换层（zram）
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include "../type.h"
+
+#define ZRAM_MAXLEN 3072        // 压缩后超过这个长度的页不值得保存
+#define ZRAM_ZERO   ((void*)1)  // 全零页不占用池空间
+
+// zram.c
+void  zram_init(void);
+void* zram_store(void *pa, uint *len);
+void  zram_load(void *obj, uint len, void *pa);
+void  zram_free(void *obj, uint len);
+void  zram_stats(void);
+
+#endif // ZRAM_H
@@ -0,0 +1,8 @@
+// 内核参数，C代码和汇编（entry.S）共用，只能包含#define
+#ifndef PARAM_H
+#define PARAM_H
+
+#define NCPU          8      // 最大CPU数
+#define BOOTSTACKSIZE 4096   // entry.S中每个CPU的启动栈大小(字节)
+
+#endif // PARAM_H
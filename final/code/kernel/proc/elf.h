@@ -0,0 +1,48 @@
+// ELF可执行文件格式
+#ifndef ELF_H
+#define ELF_H
+
+#include "../type.h"
+
+#define ELF_MAGIC 0x464C457FU  // 小端序的 "\x7FELF"
+
+// 文件头
+struct elfhdr {
+  uint magic;  // 必须等于ELF_MAGIC
+  uchar elf[12];
+  ushort type;
+  ushort machine;
+  uint version;
+  uint64 entry;
+  uint64 phoff;
+  uint64 shoff;
+  uint flags;
+  ushort ehsize;
+  ushort phentsize;
+  ushort phnum;
+  ushort shentsize;
+  ushort shnum;
+  ushort shstrndx;
+};
+
+// 程序段头
+struct proghdr {
+  uint32 type;
+  uint32 flags;
+  uint64 off;
+  uint64 vaddr;
+  uint64 paddr;
+  uint64 filesz;
+  uint64 memsz;
+  uint64 align;
+};
+
+// proghdr的type
+#define ELF_PROG_LOAD           1
+
+// proghdr的flags
+#define ELF_PROG_FLAG_EXEC      1
+#define ELF_PROG_FLAG_WRITE     2
+#define ELF_PROG_FLAG_READ      4
+
+#endif // ELF_H
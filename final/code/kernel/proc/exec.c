@@ -0,0 +1,175 @@
+// 程序装入（exec）
+//
+// exec()不把程序读入内存，只为ELF文件的每个装入段建立一个私有映射区
+// (MAP_IMAGE)，程序运行时按页缺页读入；只读段的页取自文本缓存，
+// 运行同一程序的进程共享这些物理页（见mmap.c）。
+// 映像之上是一页参数页：argv指针数组在前，各参数字符串紧随其后；
+// 参数页之上是进程的堆，sbrk从这里开始增长。
+//
+// 与已有的进程一样，程序在S模式下运行，使用进程的内核栈，
+// 从入口函数返回时以返回值调用exit()。
+// 装入段的虚拟地址和文件偏移必须页对齐。
+
+#include "../type.h"
+#include "../def.h"
+#include "../mm/memlayout.h"
+#include "../mm/mmap.h"
+#include "../mm/page.h"
+#include "../utils/string.h"
+#include "proc.h"
+#include "elf.h"
+#include "../fs/fs.h"
+#include "../fs/file.h"
+#include "../fs/log.h"
+
+// 用path处的程序替换当前进程的映像，argv以0结尾。成功时不返回，失败返回-1，
+// 失败时进程的映像保持不变。
+int
+exec(char *path, char **argv)
+{
+  struct proc *p = myproc();
+  struct vma img[NVMA];
+  struct elfhdr elf;
+  struct proghdr ph;
+  struct inode *ip;
+  struct file *f = 0;
+  pagetable_t pagetable = 0, oldpagetable;
+  uint64 top = USERBASE, argva, *uargv;
+  char *args = 0, *s, *last;
+  int nimg = 0, argc, i, off;
+  uint sp, n;
+
+  memset(img, 0, sizeof(img));
+
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+
+  if(ip->type != T_FILE)
+    goto bad;
+  if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
+    goto bad;
+  if(elf.magic != ELF_MAGIC)
+    goto bad;
+
+  // 各装入段的映射区共享一个只读打开的文件
+  if((f = filealloc()) == 0)
+    goto bad;
+  f->type = FD_INODE;
+  f->ip = idup(ip);
+  f->off = 0;
+  f->readable = 1;
+  f->writable = 0;
+
+  for(i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)){
+    struct vma *v;
+
+    if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
+      goto bad;
+    if(ph.type != ELF_PROG_LOAD)
+      continue;
+    if(ph.memsz < ph.filesz || ph.vaddr + ph.memsz < ph.vaddr)
+      goto bad;
+    if((ph.vaddr % PGSIZE) != 0 || (ph.off % PGSIZE) != 0)
+      goto bad;
+    // 装入段按地址递增排列且互不重叠，最上面留出参数页
+    if(ph.vaddr < top || ph.vaddr + ph.memsz > USERTOP - PGSIZE)
+      goto bad;
+    if(ph.off + ph.filesz > ip->size || nimg == NVMA)
+      goto bad;
+
+    v = &img[nimg++];
+    v->used = 1;
+    v->start = ph.vaddr;
+    v->len = PGROUNDUP(ph.memsz);
+    v->prot = PROT_READ;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      v->prot |= PROT_WRITE;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      v->prot |= PROT_EXEC;
+    v->flags = MAP_PRIVATE | MAP_IMAGE;
+    v->advice = MADV_NORMAL;
+    v->f = filedup(f);
+    v->off = ph.off;
+    v->fsize = ph.filesz;
+    // 没有.bss的只读段整页来自文件，可以在进程之间共享
+    if((ph.flags & ELF_PROG_FLAG_WRITE) == 0 && ph.filesz == ph.memsz)
+      v->tc = text_get(ip);
+    top = v->start + v->len;
+  }
+  iunlockput(ip);
+  end_op();
+  ip = 0;
+  if(nimg == 0)
+    goto bad;
+
+  // 参数页
+  argva = top;
+  if((pagetable = uvmcreate()) == 0)
+    goto bad;
+  if((args = kalloc_zeroed()) == 0)
+    goto bad;
+  uargv = (uint64*)args;
+  for(argc = 0; argv && argv[argc]; argc++)
+    if(argc >= MAXARG)
+      goto bad;
+  sp = (argc + 1) * sizeof(uint64);
+  for(i = 0; i < argc; i++){
+    n = strlen(argv[i]) + 1;
+    if(sp + n > PGSIZE)
+      goto bad;
+    memmove(args + sp, argv[i], n);
+    uargv[i] = argva + sp;
+    sp += n;
+  }
+  uargv[argc] = 0;
+  if(mappages(pagetable, argva, PGSIZE, (uint64)args, PTE_U | PTE_R | PTE_W) != 0)
+    goto bad;
+
+  // 以下不会失败：丢弃旧映像，换上新页表
+  for(last = s = path; *s; s++)
+    if(*s == '/')
+      last = s + 1;
+  for(i = 0; i < sizeof(p->name) - 1 && last[i]; i++)
+    p->name[i] = last[i];
+  p->name[i] = 0;
+
+  mmap_exit(p);
+  memmove(p->vma, img, sizeof(img));
+
+  push_off();
+  oldpagetable = p->pagetable;
+  p->pagetable = pagetable;
+  p->asid = 0;              // 新页表使用新的ASID，旧ASID随旧页表作废
+  p->heapbase = argva + PGSIZE;
+  p->sz = p->heapbase;
+  p->rss = 1;
+  uvmswitch(p);
+  pop_off();
+  lru_add(args, p, argva, PGO_ANON);
+  uvmfree(oldpagetable);
+  fileclose(f);             // 各映射区持有自己的引用
+
+  exec_enter(elf.entry, p->kstack + KSTACKSIZE, argc, argva);
+
+ bad:
+  if(ip){
+    iunlockput(ip);
+    end_op();
+  }
+  if(args)
+    kfree(args);        // 参数页映射成功之后不会再失败
+  if(pagetable)
+    uvmfree(pagetable);
+  for(i = 0; i < nimg; i++){
+    if(img[i].tc)
+      text_put(img[i].tc);
+    fileclose(img[i].f);
+  }
+  if(f)
+    fileclose(f);
+  return -1;
+}
@@ -1,27 +1,127 @@
 // 进程管理核心实现 - 优先级调度版本
+//
+// 每个CPU运行自己的scheduler()，共享进程表，各有一组就绪队列。加锁规则：
+//   p->lock    保护p->state、chan、killed、xstate、pid。进程切换期间一直持有：
+//              让出CPU的一方在sched()之前获取，由调度器在swtch()返回后释放，
+//              因此进程重新入队后，其他CPU要等它完全离开原来的内核栈才能运行它
+//   wait_lock  保护p->parent，保证exit()唤醒父进程时wait()不会错过
+//   rq->lock   保护一个CPU的就绪队列，同一时刻最多持有一个
+// 加锁顺序：wait_lock -> p->lock -> rq->lock
 #include "proc.h"
 #include "../def.h"
 #include "../mm/memlayout.h"
+#include "../mm/slab.h"
+#include "../mm/page.h"
+#include "../boot/fdt.h"
+#include "../utils/string.h"
 
 // 全局进程表
 struct proc proc[NPROC];
 
-// CPU结构（单核）
-struct cpu cpus[1];
+// 每个CPU一个结构
+struct cpu cpus[NCPU];
 
 // 下一个要分配的进程ID
 static int nextpid = 1;
 
+// 见文件开头的加锁规则
+struct spinlock wait_lock;
+
 // 初始进程（idle进程）
 struct proc *initproc;
 
-static int last_selected_idx = -1;
+// 就绪队列：每个优先级一个FIFO队列，bitmap的第k位表示优先级
+// MIN_PRIORITY+k的队列非空。选择下一个进程只需找到bitmap的最高位
+// 并取队首，代价与NPROC无关；同一优先级的进程按入队顺序轮转。
+// 进程变为RUNNABLE时入队（create_process、fork、yield、wakeup、kill），
+// 被调度器选中时出队。
+//
+// 每个CPU一组就绪队列，入队和出队通常只锁本CPU的队列。进程回到上次运行的
+// CPU的队列，新进程放到队列最短的CPU。本地队列为空的CPU从最忙的CPU偷一个
+// 进程（select_highest_priority），各CPU的时钟中断还会定期把长队列中的
+// 进程拉到短队列（runq_balance），修正长期的不均衡。
+//
+// Aging是惰性的：入队时记下时刻，选择时才按等待时长和该优先级的规则
+// 算出有效优先级，被选中后回到基础优先级。同一队列按FIFO排列，队首
+// 等待最久，因此只需比较各非空队列的队首，不遍历队列中的其他进程。
+//
+// 启动参数sched=fair换成公平调度：每个进程按优先级对应的权重累计虚拟运行
+// 时间vruntime（实际运行时间 * FAIR_WEIGHT0 / 权重），每次选vruntime最小的，
+// 长期看一直就绪的进程分得的CPU时间与权重成正比，低优先级的进程也不会饿死。
+// 队列的排列和选择由调度类(sched_class)决定，入队出队的其余部分两者共用。
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  uint bitmap;
+  int nr;                      // 队列中的进程数
+  uint64 picks;                // 调度次数
+  uint64 aged;                 // 靠aging胜过更高基础优先级的次数
+  uint64 steals;               // 本地队列为空时从其他CPU偷来的进程数
+  uint64 pulled;               // 负载均衡从其他CPU拉过来的进程数
+  uint64 lensum;               // 每次时钟中断时的队列长度之和，除以samples为平均长度
+  uint64 samples;
+  int maxlen;                  // 时钟中断时观察到的最大队列长度
+  struct proc *fair_head;      // 公平调度：按vruntime升序排列的就绪进程
+  uint64 min_vruntime;         // 公平调度：队列的vruntime基准，单调不减
+} runqs[NCPU];
+
+// 调度类：决定一个CPU的就绪进程怎样排列、接下来运行哪一个。调用者持有rq->lock
+struct sched_class {
+  char *name;                  // 启动参数sched=的取值
+  char *desc;
+  void (*enqueue)(struct runq *rq, struct proc *p);
+  void (*dequeue)(struct runq *rq, struct proc *p);
+  struct proc* (*pick)(struct runq *rq, uint64 now);   // 不出队
+};
+
+static struct sched_class prio_class, fair_class;
+static struct sched_class *sclass = &prio_class;
+
+// 公平调度中各优先级的权重：相邻两级约差1.25倍，默认优先级为FAIR_WEIGHT0
+static const int fair_weight[NPRIO] = {
+  335, 423, 526, 655, 820, 1024, 1277, 1586, 1991, 2501, 3121
+};
+
+// 入队时vruntime最多比队列基准小这么多（time计数）
+#define FAIR_WAKEUP_CREDIT TIMESLICE
+
+// 每个基础优先级的aging规则：在就绪队列中每等待interval（time计数）
+// 有效优先级提升AGING_BOOST级，最高到cap；interval为0表示不提升
+struct aging_rule {
+  uint64 interval;
+  int cap;
+} aging[NPRIO];
+
+static void make_runnable(struct proc *p);
+
+// 调度器每次空闲时最多清零的页数，保持较小以免推迟新就绪的进程
+#define ZPOOL_IDLE_BATCH 4
+
+// 陷阱帧对象缓存（陷阱帧只有几百字节，不必独占一页）
+static struct kmem_cache *trapframe_cache;
+
+// 新分配的陷阱帧清零
+static void
+trapframe_ctor(void *obj)
+{
+  memset(obj, 0, sizeof(struct trapframe));
+}
+
+// 获取当前CPU编号（start()将hartid保存在tp中）
+// 调用时必须关中断，防止被迁移到其他CPU
+int
+cpuid(void)
+{
+  int id = r_tp();
+  return id;
+}
 
 // 获取当前CPU
 struct cpu*
 mycpu(void) 
 {
-  return &cpus[0];
+  return &cpus[cpuid()];
 }
 
 // 获取当前进程
@@ -40,6 +140,9 @@ static void
 proc_entry(void)
 {
   struct proc *p = myproc();
+
+  // 调度器切换过来时持有p->lock
+  release(&p->lock);
   
   // 执行进程的实际入口函数
   if(p->entry_func) {
@@ -52,7 +155,8 @@ proc_entry(void)
   exit(0);
 }
 
-// 分配一个进程结构体
+// 分配一个进程结构体。进程处于USED状态，只有调用者会访问它，
+// 因此分配资源时不持有p->lock（分配内存可能唤醒回收守护进程）
 struct proc*
 allocproc(void)
 {
@@ -60,77 +164,105 @@ allocproc(void)
 
   // 在进程表中查找UNUSED状态的进程槽位
   for(p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
     if(p->state == UNUSED) {
       goto found;
     }
+    release(&p->lock);
   }
   return 0;
 
 found:
-  p->pid = nextpid++;
+  p->pid = __sync_fetch_and_add(&nextpid, 1);
   p->state = USED;
+  release(&p->lock);
   p->priority = DEFAULT_PRIORITY;  // 设置默认优先级
   p->ticks = 0;                    // 初始化CPU时间
   p->wait_time = 0;                // 初始化等待时间
   p->entry_func = 0;
+  p->asid = 0;
+  p->cpu = -1;
+  p->migrations = 0;
+  p->sum_exec = 0;
+  p->vruntime = 0;
+  p->tlb_stale = 0;
+  p->pinned = 0;
+  p->heapbase = USERBASE;
+  p->sz = USERBASE;
+  p->rss = 0;
+  p->minflt = 0;
+  p->cowflt = 0;
+  p->majflt = 0;
+  memset(p->vma, 0, sizeof(p->vma));
   
   // 分配陷阱帧
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  if((p->trapframe = (struct trapframe *)kmem_cache_alloc(trapframe_cache)) == 0){
     freeproc(p);
     return 0;
   }
 
-  // 分配用户页表
-  if((p->pagetable = create_pagetable()) == 0){
+  // 分配进程页表（内核部分与内核页表共享）
+  if((p->pagetable = uvmcreate()) == 0){
     freeproc(p);
     return 0;
   }
 
-  // 为内核栈分配一个物理页
-  if((p->kstack = (uint64)kalloc()) == 0) {
+  // 为内核栈分配物理上连续的多个页
+  if((p->kstack = (uint64)kalloc_pages(KSTACK_ORDER)) == 0) {
     freeproc(p);
     return 0;
   }
+  page_set_owner(p->kstack, PGO_KSTACK);
 
   // 清空上下文
   memset(&p->context, 0, sizeof(p->context));
   
   // 设置上下文:返回地址指向proc_entry包装函数
   p->context.ra = (uint64)proc_entry;
-  p->context.sp = p->kstack + PGSIZE;
+  p->context.sp = p->kstack + KSTACKSIZE;
   
   memset(p->ofile, 0, sizeof(p->ofile));
   return p;
 }
 
-// 释放进程资源
+// 释放进程资源。p是USED状态（allocproc()失败）或已被wait()回收的僵尸进程，
+// 最后在p->lock下把槽位还给allocproc()
 void
 freeproc(struct proc *p)
 {
   if(p->trapframe)
-    kfree((void*)p->trapframe);
+    kmem_cache_free(trapframe_cache, p->trapframe);
   p->trapframe = 0;
   
   if(p->pagetable)
-    free_pagetable(p->pagetable);
+    uvmfree(p->pagetable);
   p->pagetable = 0;
 
   if(p->kstack)
-      kfree((void*)p->kstack);
+      kfree_pages((void*)p->kstack, KSTACK_ORDER);
   p->kstack = 0;
   
+  p->asid = 0;
+  p->heapbase = 0;
   p->sz = 0;
-  p->pid = 0;
+  p->rss = 0;
+  p->minflt = 0;
+  p->cowflt = 0;
+  p->majflt = 0;
   p->parent = 0;
   p->name[0] = 0;
-  p->chan = 0;
-  p->killed = 0;
-  p->xstate = 0;
   p->entry_func = 0;
   p->priority = DEFAULT_PRIORITY;
   p->ticks = 0;
   p->wait_time = 0;
+
+  acquire(&p->lock);
+  p->pid = 0;
+  p->chan = 0;
+  p->killed = 0;
+  p->xstate = 0;
   p->state = UNUSED;
+  release(&p->lock);
 }
 
 // 初始化进程系统
@@ -138,20 +270,48 @@ void
 procinit(void)
 {
   struct proc *p;
+  char buf[16];
   
+  trapframe_cache = kmem_cache_create("trapframe", sizeof(struct trapframe),
+                                      trapframe_ctor);
+  kmem_cache_set_owner(trapframe_cache, PGO_TRAPFRAME);
+
+  initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
   for(p = proc; p < &proc[NPROC]; p++) {
+    initlock(&p->lock, "proc");
     p->state = UNUSED;
     p->kstack = 0;
     p->priority = DEFAULT_PRIORITY;
     p->ticks = 0;
     p->wait_time = 0;
+    p->on_rq = 0;
   }
+
+  // 默认规则：每等待AGING_THRESHOLD个时间片提升一级，可以一直提升到最高优先级
+  for(int prio = MIN_PRIORITY; prio <= MAX_PRIORITY; prio++)
+    aging_config(prio, prio < MAX_PRIORITY ? AGING_THRESHOLD * TIMESLICE : 0,
+                 MAX_PRIORITY);
   
-  memset(&cpus[0].context, 0, sizeof(struct context));
-  cpus[0].noff = 0;
-  cpus[0].intena = 0;
+  for(int i = 0; i < NCPU; i++) {
+    memset(&cpus[i].context, 0, sizeof(struct context));
+    cpus[i].proc = 0;
+    cpus[i].noff = 0;
+    cpus[i].intena = 0;
+    cpus[i].asid_gen = 0;
+    cpus[i].online = 0;
+  }
+  
+  // 启动参数sched=选择调度类
+  if(bootarg("sched", buf, sizeof(buf)) >= 0){
+    if(strcmp(buf, fair_class.name) == 0)
+      sclass = &fair_class;
+    else if(strcmp(buf, prio_class.name) != 0)
+      printf("procinit: unknown sched=%s, using %s\n", buf, sclass->name);
+  }
   
-  printf("进程系统初始化完成 (优先级调度)\n");
+  printf("进程系统初始化完成 (调度类: %s)\n", sclass->name);
   printf("优先级范围: %d-%d, 默认优先级: %d\n", 
          MIN_PRIORITY, MAX_PRIORITY, DEFAULT_PRIORITY);
 }
@@ -167,8 +327,6 @@ create_process(void (*entry)(void), char *name, int priority)
     return -1;
   }
   
-  p->parent = myproc();
-  
   // 设置进程名称
   int i;
   for(i = 0; i < 15 && name[i]; i++) {
@@ -185,97 +343,480 @@ create_process(void (*entry)(void), char *name, int priority)
   p->entry_func = entry;
   
   // 设置为可运行状态
-  p->state = RUNNABLE;
+  acquire(&wait_lock);
+  p->parent = myproc();
+  release(&wait_lock);
+  acquire(&p->lock);
+  make_runnable(p);
+  release(&p->lock);
   
   return p->pid;
 }
 
-// 选择最高优先级的可运行进程
-struct proc*
-select_highest_priority(void)
+// 创建子进程：写时复制父进程的用户区，复制打开的文件和陷阱帧。
+// 进程是内核函数，子进程无法从fork()的返回点继续执行，因此从entry开始运行，
+// entry为0时从父进程的入口函数重新开始。子进程陷阱帧中的a0为0。
+// 返回子进程的pid，失败返回-1。
+int
+fork(void (*entry)(void))
+{
+  struct proc *np;
+  struct proc *p = myproc();
+  int i;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  if(uvmcopy(p, np->pagetable) < 0){
+    freeproc(np);
+    return -1;
+  }
+  np->heapbase = p->heapbase;
+  np->sz = p->sz;
+  np->rss = p->rss;
+  mmap_dup(p, np);
+
+  *np->trapframe = *p->trapframe;
+  np->trapframe->a0 = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+
+  for(i = 0; i < 15 && p->name[i]; i++)
+    np->name[i] = p->name[i];
+  np->name[i] = 0;
+
+  np->priority = p->priority;
+  np->vruntime = p->vruntime;
+  np->entry_func = entry ? entry : p->entry_func;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+  acquire(&np->lock);
+  make_runnable(np);
+  release(&np->lock);
+
+  return np->pid;
+}
+
+// 最高的置位位的下标，x不为0（不依赖libgcc的__builtin_clz）
+static int
+fls(uint x)
+{
+  int n = 0;
+
+  if(x & 0xFFFF0000) { n += 16; x >>= 16; }
+  if(x & 0xFF00)     { n += 8;  x >>= 8; }
+  if(x & 0xF0)       { n += 4;  x >>= 4; }
+  if(x & 0xC)        { n += 2;  x >>= 2; }
+  if(x & 0x2)        { n += 1; }
+  return n;
+}
+
+// 优先级调度：把p放到其优先级队列的尾部
+static void
+prio_enqueue(struct runq *rq, struct proc *p)
+{
+  int k = p->rq_idx;
+
+  p->rq_next = 0;
+  p->rq_prev = rq->tail[k];
+  if(rq->tail[k])
+    rq->tail[k]->rq_next = p;
+  else
+    rq->head[k] = p;
+  rq->tail[k] = p;
+  rq->bitmap |= 1U << k;
+}
+
+static void
+prio_dequeue(struct runq *rq, struct proc *p)
+{
+  int k = p->rq_idx;
+
+  if(p->rq_prev)
+    p->rq_prev->rq_next = p->rq_next;
+  else
+    rq->head[k] = p->rq_next;
+  if(p->rq_next)
+    p->rq_next->rq_prev = p->rq_prev;
+  else
+    rq->tail[k] = p->rq_prev;
+  if(rq->head[k] == 0)
+    rq->bitmap &= ~(1U << k);
+}
+
+// 公平调度：按vruntime升序插入，相同时排在后面
+static void
+fair_enqueue(struct runq *rq, struct proc *p)
+{
+  struct proc **pp = &rq->fair_head, *prev = 0;
+
+  // 睡眠或新建的进程vruntime可能远小于基准，只保留一点领先，
+  // 不能靠睡眠攒下的时间长期独占CPU
+  if(p->vruntime + FAIR_WAKEUP_CREDIT < rq->min_vruntime)
+    p->vruntime = rq->min_vruntime - FAIR_WAKEUP_CREDIT;
+  while(*pp && (*pp)->vruntime <= p->vruntime){
+    prev = *pp;
+    pp = &prev->rq_next;
+  }
+  p->rq_prev = prev;
+  p->rq_next = *pp;
+  if(*pp)
+    (*pp)->rq_prev = p;
+  *pp = p;
+}
+
+static void
+fair_dequeue(struct runq *rq, struct proc *p)
+{
+  if(p->rq_prev)
+    p->rq_prev->rq_next = p->rq_next;
+  else
+    rq->fair_head = p->rq_next;
+  if(p->rq_next)
+    p->rq_next->rq_prev = p->rq_prev;
+}
+
+// 队首的vruntime最小。选中时把队列基准推进到它
+static struct proc*
+fair_pick(struct runq *rq, uint64 now)
+{
+  struct proc *p = rq->fair_head;
+
+  if(p && p->vruntime > rq->min_vruntime)
+    rq->min_vruntime = p->vruntime;
+  return p;
+}
+
+// p从from的队列换到to的队列：保持它相对队列基准的位置。
+// 不持有from->lock，基准只增不减，读到稍旧的值无妨
+static void
+fair_migrate(struct proc *p, struct runq *from, struct runq *to)
+{
+  if(p->vruntime + to->min_vruntime < from->min_vruntime)
+    p->vruntime = 0;
+  else
+    p->vruntime = p->vruntime + to->min_vruntime - from->min_vruntime;
+}
+
+// 把p加入rq。调用者持有rq->lock
+static void
+runq_add(struct runq *rq, struct proc *p)
+{
+  if(p->on_rq)
+    panic("runq_add");
+  p->rq_cpu = rq - runqs;
+  p->rq_idx = p->priority - MIN_PRIORITY;
+  sclass->enqueue(rq, p);
+  rq->nr++;
+  p->on_rq = 1;
+}
+
+// 把p从它所在的就绪队列rq中摘下。调用者持有rq->lock
+static void
+runq_del(struct runq *rq, struct proc *p)
+{
+  if(!p->on_rq || p->rq_cpu != rq - runqs)
+    panic("runq_del");
+  sclass->dequeue(rq, p);
+  rq->nr--;
+  p->rq_next = p->rq_prev = 0;
+  p->on_rq = 0;
+}
+
+// 锁住p所在的就绪队列并返回它，p不在任何队列中时返回0。
+// 负载均衡可能同时把p移到别的队列，加锁后要再确认
+static struct runq*
+runq_lock_proc(struct proc *p)
+{
+  struct runq *rq;
+
+  for(;;){
+    if(!p->on_rq)
+      return 0;
+    rq = &runqs[p->rq_cpu];
+    acquire(&rq->lock);
+    if(p->on_rq && p->rq_cpu == rq - runqs)
+      return rq;
+    release(&rq->lock);
+  }
+}
+
+// 进程入队的CPU：回到上次运行的CPU，它的缓存和TLB里可能还有这个进程的数据；
+// 新进程放到队列最短的在线CPU上。调用时关中断
+static struct runq*
+runq_target(struct proc *p)
+{
+  int cpu = p->cpu;
+
+  if(cpu < 0 || !cpus[cpu].online){
+    cpu = cpuid();
+    for(int i = 0; i < NCPU; i++)
+      if(cpus[i].online && runqs[i].nr < runqs[cpu].nr)
+        cpu = i;
+  }
+  return &runqs[cpu];
+}
+
+// 进程变为可运行，进入就绪队列并记下入队时刻。调用者持有p->lock
+static void
+make_runnable(struct proc *p)
+{
+  struct runq *rq = runq_target(p);
+
+  p->state = RUNNABLE;
+  if(sclass == &fair_class && p->cpu >= 0 && rq != &runqs[p->cpu])
+    fair_migrate(p, &runqs[p->cpu], rq);
+  acquire(&rq->lock);
+  p->enq_time = r_time();
+  runq_add(rq, p);
+  release(&rq->lock);
+}
+
+// 设置基础优先级为priority的进程的aging规则
+void
+aging_config(int priority, uint64 interval, int cap)
+{
+  struct aging_rule *r = &aging[priority - MIN_PRIORITY];
+
+  if(cap < priority)
+    cap = priority;
+  if(cap > MAX_PRIORITY)
+    cap = MAX_PRIORITY;
+  r->interval = interval;
+  r->cap = cap;
+}
+
+// 就绪进程p在now时刻的有效优先级
+int
+effective_priority(struct proc *p, uint64 now)
+{
+  struct aging_rule *r = &aging[p->priority - MIN_PRIORITY];
+  uint64 boost;
+
+  if(r->interval == 0 || now <= p->enq_time)
+    return p->priority;
+  boost = (now - p->enq_time) / r->interval * AGING_BOOST;
+  if(boost >= r->cap - p->priority)
+    return r->cap;
+  return p->priority + boost;
+}
+
+// 优先级调度：rq中有效优先级最高的进程。有效优先级相同时选等待更久的，
+// 提升到同一级的低优先级进程不会一直输给新入队的进程。
+static struct proc*
+prio_pick(struct runq *rq, uint64 now)
 {
   struct proc *p, *best = 0;
-  int best_priority = MIN_PRIORITY - 1;
-  int found = 0;
-  
-  // 从上次选择的位置之后开始搜索
-  int start_idx = (last_selected_idx + 1) % NPROC;
-  
-  for(int i = 0; i < NPROC; i++) {
-    p = &proc[(start_idx + i) % NPROC];
-    if(p->state == RUNNABLE) {
-      if(p->priority > best_priority) {
-        best_priority = p->priority;
-        best = p;
-        found = 1;
-      }
+  int k, prio, bestprio = -1;
+
+  for(uint bits = rq->bitmap; bits; bits &= ~(1U << k)){
+    k = fls(bits);
+    p = rq->head[k];
+    // 更低的队列最多提升到各自的cap，不可能胜出时不必再算
+    if(aging[k].cap < bestprio)
+      continue;
+    prio = effective_priority(p, now);
+    if(prio > bestprio || (prio == bestprio && p->enq_time < best->enq_time)){
+      best = p;
+      bestprio = prio;
     }
   }
-  
-  if(found) {
-    last_selected_idx = best - proc;  // 保存本次选择的索引
+  return best;
+}
+
+static struct sched_class prio_class = {
+  .name = "prio",
+  .desc = "优先级调度算法 (带Aging机制)",
+  .enqueue = prio_enqueue,
+  .dequeue = prio_dequeue,
+  .pick = prio_pick,
+};
+
+static struct sched_class fair_class = {
+  .name = "fair",
+  .desc = "加权公平调度 (按优先级的权重分配CPU时间)",
+  .enqueue = fair_enqueue,
+  .dequeue = fair_dequeue,
+  .pick = fair_pick,
+};
+
+// 当前调度类的名字
+char*
+sched_name(void)
+{
+  return sclass->name;
+}
+
+// 从rq中取出它接下来要运行的进程，没有时返回0
+static struct proc*
+runq_take(struct runq *rq, uint64 now)
+{
+  struct proc *p;
+
+  acquire(&rq->lock);
+  if((p = sclass->pick(rq, now)) != 0)
+    runq_del(rq, p);
+  release(&rq->lock);
+  return p;
+}
+
+// 除rq外进程最多的在线CPU的队列，都为空时返回0。不加锁读nr，只作参考
+static struct runq*
+runq_busiest(struct runq *rq)
+{
+  struct runq *busiest = 0;
+
+  for(int i = 0; i < NCPU; i++){
+    if(&runqs[i] == rq || runqs[i].nr == 0)
+      continue;
+    if(busiest == 0 || runqs[i].nr > busiest->nr)
+      busiest = &runqs[i];
   }
-  
+  return busiest;
+}
+
+// 取出本CPU下一个要运行的进程。本地队列为空时从最忙的CPU偷一个，
+// 都没有时返回0。只由调度器调用，调度器线程不会换CPU
+struct proc*
+select_highest_priority(void)
+{
+  struct runq *rq = &runqs[cpuid()], *busiest;
+  struct proc *best;
+  uint64 now = r_time();
+
+  acquire(&rq->lock);
+  if((best = sclass->pick(rq, now)) != 0){
+    rq->picks++;
+    if(sclass == &prio_class && best->priority - MIN_PRIORITY != fls(rq->bitmap))
+      rq->aged++;
+    runq_del(rq, best);
+  }
+  release(&rq->lock);
+
+  if(best == 0 && (busiest = runq_busiest(rq)) != 0 &&
+     (best = runq_take(busiest, now)) != 0){
+    if(sclass == &fair_class)
+      fair_migrate(best, busiest, rq);
+    rq->picks++;
+    rq->steals++;
+  }
+  if(best)
+    best->wait_time = (now - best->enq_time) / TIMESLICE;
   return best;
 }
 
-// Aging机制：防止进程饥饿
+// 时钟中断中调用：记录本CPU的队列长度，每隔BALANCE_TICKS次检查一次负载，
+// 最忙的CPU比本CPU多出至少两个就绪进程时拉一半差额过来。
+// 空闲的CPU在调度器中偷进程，这里处理各CPU都忙、但队列长度相差较大的情况
 void
-aging_update(void)
+runq_balance(void)
 {
+  struct runq *rq = &runqs[cpuid()], *busiest;
   struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p->state == RUNNABLE) {
-      p->wait_time++;
-      
-      // 如果等待时间超过阈值，提升优先级
-      if(p->wait_time >= AGING_THRESHOLD) {
-        if(p->priority < MAX_PRIORITY) {
-          p->priority += AGING_BOOST;
-          printf("[AGING] Process %d (%s): priority boosted to %d\n", 
-                 p->pid, p->name, p->priority);
-        }
-        p->wait_time = 0;  // 重置等待时间
-      }
+  uint64 now = r_time();
+  int move;
+
+  rq->lensum += rq->nr;
+  rq->samples++;
+  if(rq->nr > rq->maxlen)
+    rq->maxlen = rq->nr;
+
+  if(rq->samples % BALANCE_TICKS != 0 || (busiest = runq_busiest(rq)) == 0)
+    return;
+  // 没有锁，只在差额足够大时才尝试，移动时各队列逐个加锁
+  move = (busiest->nr - rq->nr) / 2;
+  while(move-- > 0 && (p = runq_take(busiest, now)) != 0){
+    if(sclass == &fair_class)
+      fair_migrate(p, busiest, rq);
+    acquire(&rq->lock);
+    runq_add(rq, p);
+    rq->pulled++;
+    release(&rq->lock);
+  }
+}
+
+// 修改进程的优先级，就绪的进程重新入队（优先级调度中移到新优先级的队列尾部）。
+// 公平调度中新的权重从下一次运行开始生效
+void
+setpriority(struct proc *p, int priority)
+{
+  struct runq *rq;
+
+  p->priority = priority;
+  if((rq = runq_lock_proc(p)) != 0){
+    if(p->rq_idx != priority - MIN_PRIORITY){
+      runq_del(rq, p);
+      runq_add(rq, p);
     }
+    release(&rq->lock);
   }
 }
 
-// 进程主动让出CPU
+
+// 固定一个不在运行的进程：在proc_unpin()之前它不会被调度，也不会被回收，
+// 其他进程（回收、KSM）可以修改它的页表。p正在运行、已退出或还没有
+// 页表时返回0。可以嵌套；固定期间不持有锁，可以分配内存
+int
+proc_pin(struct proc *p)
+{
+  int ok;
+
+  acquire(&p->lock);
+  ok = (p->state == RUNNABLE || p->state == SLEEPING) && p->pagetable != 0;
+  if(ok)
+    p->pinned++;
+  release(&p->lock);
+  return ok;
+}
+
+void
+proc_unpin(struct proc *p)
+{
+  acquire(&p->lock);
+  if(p->pinned < 1)
+    panic("proc_unpin");
+  p->pinned--;
+  release(&p->lock);
+}
+
+// 进程主动让出CPU。调度器记完这次运行的时间后才把它放回就绪队列
 void
 yield(void)
 {
   struct proc *p = myproc();
   
-  if(p) {
-    p->state = RUNNABLE;
-    p->wait_time = 0;  // 重置等待时间
-  }
+  acquire(&p->lock);
+  p->state = RUNNABLE;
   sched();
+  release(&p->lock);
 }
 
-// 切换到调度器
+// 切换到调度器。调用者只持有p->lock，并已修改p->state。
+// intena属于当前CPU，进程可能在另一个CPU上继续运行，因此随进程保存和恢复
 void
 sched(void)
 {
+  int intena;
   struct proc *p = myproc();
-  struct cpu *c = mycpu();
   
   if(!p)
     panic("sched: no proc");
-    
+  if(!holding(&p->lock))
+    panic("sched p->lock");
+  if(mycpu()->noff != 1)
+    panic("sched locks");
   if(p->state == RUNNING)
     panic("sched running");
+  if(intr_get())
+    panic("sched interruptible");
   
-  int intena = intr_get();
-  
-  swtch(&p->context, &c->context);
-  
-  // 恢复中断状态
-  if(intena) {
-    intr_on();
-  }
+  intena = mycpu()->intena;
+  swtch(&p->context, &mycpu()->context);
+  mycpu()->intena = intena;
 }
 
 // 调度器 - 优先级调度算法（带Aging）
@@ -284,86 +825,113 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  uint64 start, delta;
   
   c->proc = 0;
+  c->online = 1;
   
-  printf("调度器启动 - 优先级调度算法 (带Aging机制)\n");
+  printf("CPU %d: 调度器启动 - %s\n", cpuid(), sclass->desc);
   
   int idle_count = 0;
-  int aging_counter = 0;
   
   for(;;){
     // 开启中断，允许设备中断
     intr_on();
     
-    // 周期性执行aging更新
-    aging_counter++;
-    if(aging_counter >= 10) {  // 每10次调度循环执行一次aging
-      aging_update();
-      aging_counter = 0;
-    }
-    
-    // 选择优先级最高的可运行进程
+    // 从就绪队列取出有效优先级最高的进程
     p = select_highest_priority();
     
-    // 如果找到可运行的进程，切换过去
+    // 如果找到可运行的进程，切换过去。
+    // 进程可能刚在另一个CPU上入队，获取p->lock要等那个CPU切换离开它
     if(p) {
       idle_count = 0;  // 重置空闲计数
       
+      acquire(&p->lock);
+      if(p->pinned){
+        // 页表正被回收或KSM修改，放回队尾（保留入队时刻）稍后再运行
+        acquire(&runqs[cpuid()].lock);
+        runq_add(&runqs[cpuid()], p);
+        release(&runqs[cpuid()].lock);
+        release(&p->lock);
+        continue;
+      }
       p->state = RUNNING;
-      p->wait_time = 0;  // 重置等待时间
       c->proc = p;
+      if(p->cpu >= 0 && p->cpu != cpuid())
+        p->migrations++;
       
-      // 切换到进程
+      // 切换到进程及其页表
+      start = r_time();
+      uvmswitch(p);
       swtch(&c->context, &p->context);
       
-      // 进程切换回来后
+      // 进程切换回来后换回内核页表，进程的页表可能随后被wait()释放
+      kvmswitch();
       c->proc = 0;
       
       // 更新进程统计信息
+      delta = r_time() - start;
+      p->sum_exec += delta;
+      p->vruntime += delta * FAIR_WEIGHT0 / fair_weight[p->priority - MIN_PRIORITY];
       if(p->state == RUNNABLE || p->state == RUNNING) {
         p->ticks++;  // 增加CPU使用时间
       }
+      // yield()让出的进程，按更新后的vruntime入队
+      if(p->state == RUNNABLE)
+        make_runnable(p);
+      release(&p->lock);
       
     } else {
-      // 没有可运行的进程
+      // 没有可运行的进程，利用空闲时间初始化延迟的物理内存、预先清零页
+      buddy_grow_deferred(1);
+      kzero_refill(ZPOOL_IDLE_BATCH);
       idle_count++;
       if(idle_count % 100000000 == 0) {
-        printf("[SCHEDULER] No runnable processes (idle count: %d)\n", idle_count);
+        printf("[SCHEDULER] CPU %d: no runnable processes (idle count: %d)\n",
+               cpuid(), idle_count);
       }
     }
   }
 }
 
-// 进程睡眠（等待条件）
+// 进程睡眠（等待条件）。调用者持有保护该条件的锁lk，
+// 先获取p->lock再释放lk，在此期间调用wakeup()的一方必须获取p->lock，
+// 因此不会错过唤醒。返回前重新获取lk
 void
-sleep(void *chan)
+sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
   
   if(p == 0)
     panic("sleep");
 
+  acquire(&p->lock);
+  release(lk);
+
   p->chan = chan;
   p->state = SLEEPING;
-  p->wait_time = 0;  // 睡眠时重置等待时间
 
   sched();
 
   // 被唤醒后清空通道
   p->chan = 0;
+
+  release(&p->lock);
+  acquire(lk);
 }
 
-// 唤醒等待在chan上的所有进程
+// 唤醒等待在chan上的所有进程。调用时不能持有任何p->lock
 void
 wakeup(void *chan)
 {
   struct proc *p;
 
   for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc() && p->state == SLEEPING && p->chan == chan){
-      p->state = RUNNABLE;
-      p->wait_time = 0;  // 唤醒时重置等待时间
+    if(p != myproc()){
+      acquire(&p->lock);
+      if(p->state == SLEEPING && p->chan == chan)
+        make_runnable(p);
+      release(&p->lock);
     }
   }
 }
@@ -377,7 +945,8 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // 关闭所有打开的文件
+  // 解除文件映射（共享映射写回），再关闭所有打开的文件
+  mmap_exit(p);
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
       fileclose(p->ofile[fd]);
@@ -385,6 +954,8 @@ exit(int status)
     }
   }
 
+  acquire(&wait_lock);
+
   // 唤醒父进程
   if(p->parent)
     wakeup(p->parent);
@@ -400,9 +971,13 @@ exit(int status)
   }
 
   // 进入僵尸状态
+  acquire(&p->lock);
   p->xstate = status;
   p->state = ZOMBIE;
 
+  // 父进程在wait()中检查子进程状态前要获取wait_lock，此时已是僵尸
+  release(&wait_lock);
+
   // 跳转到调度器
   sched();
   panic("zombie exit");
@@ -417,26 +992,33 @@ wait(int *status)
   int havekids;
   int pid;
 
+  acquire(&wait_lock);
   for(;;){
     havekids = 0;
     for(pp = proc; pp < &proc[NPROC]; pp++){
       if(pp->parent == p){
         havekids = 1;
+        // 获取pp->lock等退出的子进程在它的CPU上切换离开
+        acquire(&pp->lock);
         if(pp->state == ZOMBIE){
           pid = pp->pid;
           if(status != 0)
             *status = pp->xstate;
+          release(&pp->lock);
           freeproc(pp);
+          release(&wait_lock);
           return pid;
         }
+        release(&pp->lock);
       }
     }
 
     if(!havekids){
+      release(&wait_lock);
       return -1;
     }
 
-    sleep(p);
+    sleep(p, &wait_lock);
   }
 }
 
@@ -447,13 +1029,15 @@ kill(int pid)
   struct proc *p;
 
   for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
-      if(p->state == SLEEPING){
-        p->state = RUNNABLE;
-      }
+      if(p->state == SLEEPING)
+        make_runnable(p);
+      release(&p->lock);
       return 0;
     }
+    release(&p->lock);
   }
   return -1;
 }
@@ -470,8 +1054,9 @@ debug_proc_table(void) {
       [ZOMBIE]   "ZOMBIE"
   };
   
-  printf("\n=== Process Table ===\n");
-  printf("PID\tPriority\tTicks\tWait\tState\t\tName\n");
+  printf("\n=== Process Table (sched=%s) ===\n", sclass->name);
+  // Exec为累计运行时间，VRun为vruntime，都以毫秒为单位
+  printf("PID\tPriority\tTicks\tWait\tExec\tVRun\tState\t\tCPU\tMigr\tRSS\tMinFlt\tMajFlt\tCowFlt\tName\n");
   printf("------------------------------------------------------------------\n");
 
   for (int i = 0; i < NPROC; i++) {
@@ -482,11 +1067,24 @@ debug_proc_table(void) {
               state_str = states[p->state];
           }
 
-          printf("%d\t%d\t\t%d\t%d\t%s\t\t%s\n",
-                 p->pid, p->priority, p->ticks, p->wait_time, 
-                 state_str, p->name);
+          printf("%d\t%d\t\t%d\t%d\t%d\t%d\t%s\t\t%d\t%d\t%d\t%d\t%d\t%d\t%s\n",
+                 p->pid, p->priority, p->ticks, p->wait_time,
+                 (int)(p->sum_exec / 10000), (int)(p->vruntime / 10000),
+                 state_str, p->cpu, p->migrations, (int)p->rss, (int)p->minflt, (int)p->majflt,
+                 (int)p->cowflt, p->name);
       }
   }
+  printf("CPU\tRunnable\tBitmap\tPicks\tAged\tSteals\tPulled\tAvgLen\tMaxLen\n");
+  for (int i = 0; i < NCPU; i++) {
+      struct runq *rq = &runqs[i];
+      uint64 x10 = rq->samples ? rq->lensum * 10 / rq->samples : 0;
+      if (!cpus[i].online && rq->nr == 0)
+          continue;
+      printf("%d\t%d\t\t0x%x\t%d\t%d\t%d\t%d\t%d.%d\t%d\n",
+             i, rq->nr, rq->bitmap, (int)rq->picks, (int)rq->aged,
+             (int)rq->steals, (int)rq->pulled, (int)(x10 / 10), (int)(x10 % 10),
+             rq->maxlen);
+  }
   printf("==================================================================\n\n");
 }
 
@@ -497,7 +1095,7 @@ push_off(void)
   int old = intr_get();
   
   intr_off();
-  struct cpu *c = &cpus[0];
+  struct cpu *c = mycpu();
   if(c->noff == 0)
     c->intena = old;
   c->noff += 1;
@@ -507,7 +1105,7 @@ push_off(void)
 void
 pop_off(void)
 {
-  struct cpu *c = &cpus[0];
+  struct cpu *c = mycpu();
   
   if(intr_get())
     panic("pop_off - interruptible");
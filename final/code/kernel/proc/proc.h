@@ -2,18 +2,28 @@
 #ifndef PROC_H
 #define PROC_H
 #include "../type.h"
+#include "../param.h"
 #include "../mm/riscv.h"
+#include "../mm/mmap.h"
+#include "spinlock.h"
 
 // 最大进程数
 #define NPROC 64
 #define NOFILE 16 // 每个进程最大打开文件数
+#define MAXARG 32 // exec的最大参数个数
+#define KSTACK_ORDER 1                       // 内核栈占 2^KSTACK_ORDER 个连续物理页
+#define KSTACKSIZE (PGSIZE << KSTACK_ORDER)  // 内核栈大小(字节)
 
 // 优先级调度相关常量
 #define MIN_PRIORITY 0      // 最低优先级
 #define MAX_PRIORITY 10     // 最高优先级
 #define DEFAULT_PRIORITY 5  // 默认优先级
-#define AGING_THRESHOLD 5 // Aging阈值（ticks）
+#define NPRIO (MAX_PRIORITY - MIN_PRIORITY + 1)  // 优先级级数，每级一个就绪队列
+#define TIMESLICE 1000000   // 时间片长度（time计数）
+#define AGING_THRESHOLD 5   // 默认规则：就绪等待这么多个时间片提升一级有效优先级
 #define AGING_BOOST 1       // Aging时增加的优先级
+#define BALANCE_TICKS 4     // 每隔多少次时钟中断检查一次各CPU的负载
+#define FAIR_WEIGHT0 1024   // 公平调度中默认优先级的权重，vruntime按它归一化
 
 // 进程状态枚举
 enum procstate { 
@@ -51,36 +61,63 @@ struct cpu {
   struct context context;     // CPU调度器上下文
   int noff;                   // 中断关闭嵌套层数
   int intena;                 // 在push_off()之前中断是否开启
+  uint64 asid_gen;            // 本CPU的TLB已刷新到的ASID代，见vm.c
+  int online;                 // 调度器已启动，可以分配进程
 };
 
 // 进程结构体
 struct proc {
+  struct spinlock lock;
+
+  // 以下字段需要持有p->lock
   enum procstate state;        // 进程状态
+  void *chan;                  // 睡眠通道
+  int killed;                  // 是否被杀死
+  int xstate;                  // 退出状态
   int pid;                     // 进程ID
+  int pinned;                  // 页表正被其他进程修改，暂不运行（proc_pin）
+
+  // 以下字段需要持有wait_lock
+  struct proc *parent;         // 父进程指针
   
   // 优先级调度相关字段
   int priority;                // 优先级(0-10,数字越大优先级越高)
   int ticks;                   // 已使用的CPU时间片
-  int wait_time;               // 等待时长（用于aging）
+  int wait_time;               // 上次被选中前在就绪队列中等待的时间片数
+  uint64 enq_time;             // 进入就绪队列的时刻(r_time)，aging据此计算
+  int on_rq;                   // 是否在就绪队列中（RUNNABLE且未被选中）
+  int rq_cpu;                  // 所在就绪队列的CPU
+  int rq_idx;                  // 所在的优先级队列，入队后优先级可能被修改
+  struct proc *rq_next;        // 同一优先级就绪队列（公平调度：vruntime有序队列）中的前后进程
+  struct proc *rq_prev;
+  int migrations;              // 换到另一个CPU运行的次数
+  uint64 sum_exec;             // 累计运行时间（time计数）
+  uint64 vruntime;             // 按优先级的权重折算的运行时间，公平调度选最小的
   
   pagetable_t pagetable;       // 用户页表
+  uint64 asid;                 // 页表的ASID（高位为分配时的代号），见vm.c
+  int cpu;                     // 上次运行所在的CPU，-1表示还没有运行过
+  int tlb_stale;               // 不在运行时页表被其他进程修改过，切换进来时刷新ASID
   struct trapframe *trapframe; // 陷阱帧指针
   struct context context;      // 进程调度上下文
   uint64 kstack;              // 内核栈虚拟地址
-  uint64 sz;                  // 进程内存大小(字节)
-  void *chan;                 // 睡眠通道
-  int killed;                 // 是否被杀死
-  int xstate;                 // 退出状态
-  struct proc *parent;        // 父进程指针
+  uint64 heapbase;            // 堆的起始地址，exec后位于程序映像和参数页之上
+  uint64 sz;                  // 用户区大小(字节)，堆为 [heapbase, sz)，按需分配
+  uint64 rss;                 // 已映射的物理页数（常驻集）
+  uint64 minflt;              // 按需清零的缺页次数
+  uint64 cowflt;              // 写时复制的缺页次数
+  uint64 majflt;              // 文件映射的缺页次数（需要读文件）
+  struct vma vma[NVMA];       // 文件映射区
   char name[16];              // 进程名称(用于调试)
   void (*entry_func)(void);   // 进程入口函数指针
   struct file *ofile[NOFILE]; // 打开的文件表
 };
 
-extern struct cpu cpus[1];
+extern struct cpu cpus[NCPU];
 extern struct proc proc[NPROC];
 
 // 函数声明
+int cpuid(void);
 struct cpu* mycpu(void);
 struct proc* myproc(void);
 void procinit(void);
@@ -88,22 +125,33 @@ int create_process(void (*entry)(void), char *name, int priority);
 void yield(void);
 void sched(void);
 void scheduler(void);
-void sleep(void *chan);
+void sleep(void *chan, struct spinlock *lk);
 void wakeup(void *chan);
 void exit(int status);
 int wait(int *status);
 int kill(int pid);
+int fork(void (*entry)(void));
 void debug_proc_table(void);
 void freeproc(struct proc *p);
 void push_off(void);
 void pop_off(void);
 struct proc* allocproc(void);
+int  proc_pin(struct proc *p);
+void proc_unpin(struct proc *p);
 
 // 优先级调度相关函数
 struct proc* select_highest_priority(void);
-void aging_update(void);
+int  effective_priority(struct proc *p, uint64 now);
+void aging_config(int priority, uint64 interval, int cap);
+void setpriority(struct proc *p, int priority);
+void runq_balance(void);
+char* sched_name(void);
+
+// exec.c
+int exec(char *path, char **argv);
 
 // 汇编函数声明
 void swtch(struct context *old, struct context *new);
+void exec_enter(uint64 entry, uint64 sp, uint64 argc, uint64 argv) __attribute__((noreturn));
 
 #endif // PROC_H
\ No newline at end of file
@@ -0,0 +1,59 @@
+// 互斥自旋锁
+//
+// 使用原子交换(amoswap)实现，持锁期间关闭本CPU的中断，
+// 避免与中断处理程序在同一把锁上死锁。
+
+#include "../def.h"
+#include "spinlock.h"
+#include "proc.h"
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+  lk->name = name;
+  lk->locked = 0;
+  lk->cpu = 0;
+}
+
+// 获取锁，自旋直到成功
+void
+acquire(struct spinlock *lk)
+{
+  push_off(); // 关中断，避免死锁
+  if(holding(lk))
+    panic("acquire");
+
+  // 在RISC-V上编译为 amoswap.w.aq
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    ;
+
+  // 保证临界区的访存不会被重排到加锁之前
+  __sync_synchronize();
+
+  lk->cpu = mycpu();
+}
+
+// 释放锁
+void
+release(struct spinlock *lk)
+{
+  if(!holding(lk))
+    panic("release");
+
+  lk->cpu = 0;
+
+  // 保证临界区的写入在释放锁之前对其他CPU可见
+  __sync_synchronize();
+
+  // 在RISC-V上编译为 amoswap.w zero, zero, (s1)
+  __sync_lock_release(&lk->locked);
+
+  pop_off();
+}
+
+// 当前CPU是否持有该锁？调用时必须关中断
+int
+holding(struct spinlock *lk)
+{
+  return lk->locked && lk->cpu == mycpu();
+}
@@ -0,0 +1,23 @@
+// 自旋锁
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "../type.h"
+
+struct cpu;
+
+// 互斥自旋锁
+struct spinlock {
+  uint locked;       // 锁是否被持有
+
+  // 调试信息
+  char *name;        // 锁名称
+  struct cpu *cpu;   // 持有锁的CPU
+};
+
+void initlock(struct spinlock *lk, char *name);
+void acquire(struct spinlock *lk);
+void release(struct spinlock *lk);
+int  holding(struct spinlock *lk);
+
+#endif // SPINLOCK_H
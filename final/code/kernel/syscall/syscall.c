@@ -2,6 +2,7 @@
 // 负责根据系统调用号分发到具体的处理函数
 
 #include "../def.h"
+#include "../proc/proc.h"
 #include "syscall.h"
 
 // 外部系统调用函数声明
@@ -20,6 +21,10 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_setpriority(void);
 extern uint64 sys_getpriority(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_memstat(void);
 
 // 系统调用函数指针数组
 static uint64 (*syscalls[])(void) = {
@@ -38,6 +43,10 @@ static uint64 (*syscalls[])(void) = {
     [SYS_MKDIR]       = sys_mkdir,
     [SYS_SETPRIORITY] = sys_setpriority,
     [SYS_GETPRIORITY] = sys_getpriority,
+    [SYS_MMAP]        = sys_mmap,
+    [SYS_MUNMAP]      = sys_munmap,
+    [SYS_MADVISE]     = sys_madvise,
+    [SYS_MEMSTAT]     = sys_memstat,
 };
 
 // 系统调用名称（用于调试）
@@ -57,11 +66,20 @@ static char *syscall_names[] = {
     [SYS_MKDIR]       "mkdir",
     [SYS_SETPRIORITY] "setpriority",
     [SYS_GETPRIORITY] "getpriority",
+    [SYS_MMAP]        "mmap",
+    [SYS_MUNMAP]      "munmap",
+    [SYS_MADVISE]     "madvise",
+    [SYS_MEMSTAT]     "memstat",
 };
 
 // 系统调用处理函数
 void handle_syscall(struct trapframe *tf) {
     uint64 syscall_num = tf->a7;
+    struct proc *p = myproc();
+
+    // 各sys_*函数从p->trapframe读取参数，fork还要把它复制给子进程
+    if(p)
+        *p->trapframe = *tf;
     
     // 检查系统调用号是否有效
     if(syscall_num > 0 && 
@@ -25,4 +25,12 @@
 // 其他系统调用
 #define SYS_EXEC        9
 
+// 内存映射相关系统调用
+#define SYS_MMAP        16
+#define SYS_MUNMAP      17
+#define SYS_MADVISE     18
+
+// 统计相关系统调用
+#define SYS_MEMSTAT     19
+
 #endif // SYSCALL_H
\ No newline at end of file
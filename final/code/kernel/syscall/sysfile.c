@@ -320,4 +320,37 @@ uint64 sys_mkdir(void) {
     uint64 path = p->trapframe->a0;
     
     return mkdir((const char*)path);
-}
\ No newline at end of file
+}
+
+// 系统调用：把文件映射到进程地址空间
+// 参数：a0 = 地址提示（忽略）, a1 = 长度, a2 = prot, a3 = flags, a4 = fd, a5 = 文件偏移
+uint64 sys_mmap(void) {
+    struct proc *p = myproc();
+    if(!p) return -1;
+    
+    uint64 len = p->trapframe->a1;
+    int prot = p->trapframe->a2;
+    int flags = p->trapframe->a3;
+    int fd = p->trapframe->a4;
+    uint off = p->trapframe->a5;
+    
+    return mmap(len, prot, flags, fd, off);
+}
+
+// 系统调用：解除文件映射
+// 参数：a0 = 地址, a1 = 长度
+uint64 sys_munmap(void) {
+    struct proc *p = myproc();
+    if(!p) return -1;
+    
+    return munmap(p->trapframe->a0, p->trapframe->a1);
+}
+
+// 系统调用：对映射区给出访问提示
+// 参数：a0 = 地址, a1 = 长度, a2 = advice
+uint64 sys_madvise(void) {
+    struct proc *p = myproc();
+    if(!p) return -1;
+    
+    return madvise(p->trapframe->a0, p->trapframe->a1, p->trapframe->a2);
+}
@@ -3,6 +3,8 @@
 
 #include "../def.h"
 #include "../proc/proc.h"
+#include "../mm/memlayout.h"
+#include "../mm/page.h"
 #include "syscall.h"
 
 // 系统调用：进程退出
@@ -25,10 +27,12 @@ uint64 sys_getpid(void) {
 }
 
 // 系统调用：创建一个新进程（克隆当前进程）
+// 参数：a0 = 子进程的入口函数，0表示从父进程的入口函数重新开始
 uint64 sys_fork(void) {
-    printf("[SYS_FORK] Fork not fully implemented yet\n");
-    // TODO: 实现进程创建逻辑，包括复制父进程的内存空间、文件描述符等
-    return -1;
+    struct proc *p = myproc();
+    if(!p) return -1;
+
+    return fork((void (*)(void))p->trapframe->a0);
 }
 
 // 系统调用：等待子进程退出
@@ -38,10 +42,25 @@ uint64 sys_wait(void) {
 }
 
 // 系统调用：增加程序的堆内存空间
+// 参数：a0 = 增加的字节数（可为负）。返回原来的堆顶，失败返回-1
+// 增长时只移动堆顶，物理页在第一次访问时由缺页处理分配
 uint64 sys_sbrk(void) {
-    printf("[SYS_SBRK] Sbrk not fully implemented yet\n");
-    // TODO: 调整进程的数据段大小，用于动态内存分配
-    return 0;
+    struct proc *p = myproc();
+    if(!p) return -1;
+
+    int n = p->trapframe->a0;
+    uint64 oldsz = p->sz;
+
+    if(n >= 0) {
+        if(oldsz + n > mmap_floor(p))  // 不能长进文件映射区
+            return -1;
+        p->sz = oldsz + n;
+    } else {
+        if(oldsz - p->heapbase < (uint64)-n)
+            return -1;
+        p->sz = uvmdealloc(p, oldsz, oldsz + n);
+    }
+    return oldsz;
 }
 
 // 系统调用：杀死进程
@@ -88,7 +107,7 @@ uint64 sys_setpriority(void) {
     
     // 设置优先级
     int old_priority = target->priority;
-    target->priority = priority;
+    setpriority(target, priority);
     
     printf("[SYS_SETPRIORITY] Process %d (%s): priority %d -> %d\n", 
            pid, target->name, old_priority, priority);
@@ -116,9 +135,27 @@ uint64 sys_getpriority(void) {
     return -1;
 }
 
-// 系统调用：执行一个新的程序
+// 系统调用：执行一个新的程序，成功时不返回
+// 参数：a0 = 程序路径, a1 = 以0结尾的参数数组
 uint64 sys_exec(void) {
-    printf("[SYS_EXEC] Exec not fully implemented yet\n");
-    // TODO: 在当前进程的上下文中加载并执行一个新的程序
-    return -1;
-}
\ No newline at end of file
+    struct proc *p = myproc();
+    if(!p) return -1;
+
+    char *path = (char*)p->trapframe->a0;
+    char **argv = (char**)p->trapframe->a1;
+
+    return exec(path, argv);
+}
+
+// 系统调用：读取物理内存统计
+// 参数：a0 = struct memstat指针
+uint64 sys_memstat(void) {
+    struct proc *p = myproc();
+    if(!p) return -1;
+
+    struct memstat *st = (struct memstat*)p->trapframe->a0;
+    if(st == 0) return -1;
+
+    kmem_getstat(st);
+    return 0;
+}
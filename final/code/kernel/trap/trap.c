@@ -33,8 +33,18 @@ void timer_interrupt(void) {
     global_interrupt_count++;
     
     // 设置下次中断时间
-    sbi_set_timer(1000000);
+    sbi_set_timer(TIMESLICE);
+
+    // 定期唤醒相同页合并扫描，只按CPU 0的时钟计数
+    if(cpuid() == 0)
+        ksm_tick();
+
+    // vfree()之后刷新本CPU的TLB，被释放的页才能再分配
+    vmap_flush();
     
+    // 记录队列长度，定期在CPU之间平衡负载
+    runq_balance();
+
     // 触发任务调度（时间片用完）
     struct proc *p = myproc();
     if(p && p->state == RUNNING) {
@@ -136,18 +146,16 @@ void handle_exception(struct trapframe *tf) {
             handle_syscall(tf);
             break;
             
+        // 缺页是正常路径（写时复制、按需装入程序等），只在无法处理时打印
         case CAUSE_INSTRUCTION_PAGE_FAULT:
-            printf("[EXCEPTION] Instruction page fault: addr=0x%lx\n", stval);
             handle_instruction_page_fault(tf);
             break;
             
         case CAUSE_LOAD_PAGE_FAULT:
-            printf("[EXCEPTION] Load page fault: addr=0x%lx\n", stval);
             handle_load_page_fault(tf);
             break;
             
         case CAUSE_STORE_PAGE_FAULT:
-            printf("[EXCEPTION] Store page fault: addr=0x%lx\n", stval);
             handle_store_page_fault(tf);
             break;
             
@@ -157,20 +165,38 @@ void handle_exception(struct trapframe *tf) {
     }
 }
 
-// 页故障处理（简化实现）
+// 用户区缺页交给vmfault()处理，失败时终止当前进程。
+// 取指缺页还要求映射的页可执行，否则返回后会在同一条指令上反复缺页
+static void page_fault(struct trapframe *tf, int write, int exec) {
+    static char *what[] = { "Load", "Store", "Instruction" };
+    struct proc *p = myproc();
+    uint64 va = r_stval();
+    pte_t *pte;
+
+    if(p && vmfault(p, va, write) == 0){
+        if(!exec || ((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_X)))
+            return;
+    }
+
+    printf("[PAGE FAULT] %s page fault: addr=0x%x epc=0x%x\n",
+           what[exec ? 2 : write], (int)va, (int)tf->epc);
+    if(p == 0)
+        panic("page fault");
+    printf("[PAGE FAULT] Killing process %d (%s)\n", p->pid, p->name);
+    p->killed = 1;
+    exit(-1);
+}
+
 void handle_instruction_page_fault(struct trapframe *tf) {
-    printf("[PAGE FAULT] Instruction page fault not implemented\n");
-    panic("Instruction page fault");
+    page_fault(tf, 0, 1);
 }
 
 void handle_load_page_fault(struct trapframe *tf) {
-    printf("[PAGE FAULT] Load page fault not implemented\n");
-    panic("Load page fault");
+    page_fault(tf, 0, 0);
 }
 
 void handle_store_page_fault(struct trapframe *tf) {
-    printf("[PAGE FAULT] Store page fault not implemented\n");
-    panic("Store page fault");
+    page_fault(tf, 1, 0);
 }
 
 // ========== 测试函数 ==========
@@ -1,9 +1,22 @@
 #include "../def.h"
+#include "../proc/spinlock.h"
 #include <stdarg.h>
 volatile int panicking = 0; // printing a panic message
 volatile int panicked = 0;  // spinning forever at end of a panic
 static char digits[] = "0123456789abcdef";
 
+// 多个CPU同时printf时一次输出一整条消息，不互相穿插。
+// printfinit()之前只有CPU 0在输出，不加锁
+static struct {
+  struct spinlock lock;
+  int locking;
+} pr;
+
+void printfinit(void) {
+  initlock(&pr.lock, "pr");
+  pr.locking = 1;
+}
+
 // 简单的整数转字符串函数
 static void itoa(long long value, char *str, int base, int sgn) {
 
@@ -107,6 +120,10 @@ static void vprintf_internal(const char *fmt, va_list ap) {
 
 void printf(const char *fmt, ...) {
   va_list ap; // 声明va_list变量
+  int locking = pr.locking && !panicking;
+
+  if (locking)
+    acquire(&pr.lock);
 
   // 初始化可变参数列表，fmt是最后一个固定参数
   va_start(ap, fmt);
@@ -116,6 +133,9 @@ void printf(const char *fmt, ...) {
 
   // 清理可变参数列表
   va_end(ap);
+
+  if (locking)
+    release(&pr.lock);
 }
 void panic(char *s) {
   panicking = 1;
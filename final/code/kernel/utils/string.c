@@ -1,17 +1,228 @@
 #include "../type.h"
 #include "../def.h"
 
-// 基本字符串函数
+// 内存操作函数
+//
+// 内存块较长时按64位字操作：先逐字节处理到对齐边界，再每轮处理8个字，
+// 最后处理剩余的字和字节。源和目的相对对齐不同时只能逐字节复制
+// （RISC-V上非对齐的字访问会陷入或很慢）。
+// 用make RVV=1编译时，较长的内存块改用向量指令(RVV)处理，见下面的rvv_*。
+
+// 字访问可以与任何类型的访问别名
+typedef uint64 __attribute__((__may_alias__)) word_t;
+
+#define WSIZE sizeof(word_t)
+#define WMASK (WSIZE - 1)
+#define ALIGNED(p, q) ((((uint64)(p) ^ (uint64)(q)) & WMASK) == 0)
+
+#ifdef CONFIG_RVV
+// 向量寄存器不属于进程上下文，用向量指令时关中断，防止中途被调度走
+#define RVV_MIN 256    // 短于这个长度时标量路径更快
+
+// LMUL=8时一个寄存器组占8个向量寄存器
+#define RVV_CLOBBER_V0  "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7"
+#define RVV_CLOBBER_V8  "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15"
+#define RVV_CLOBBER_V16 "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23"
+
+static void rvv_copy(char *d, const char *s, uint n) {
+    uint64 vl;
+
+    push_off();
+    for(; n > 0; n -= vl, d += vl, s += vl)
+        asm volatile("vsetvli %0, %1, e8, m8, ta, ma\n"
+                     "vle8.v v0, (%2)\n"
+                     "vse8.v v0, (%3)\n"
+                     : "=&r"(vl) : "r"(n), "r"(s), "r"(d)
+                     : "memory", RVV_CLOBBER_V0);
+    pop_off();
+}
+
+static void rvv_set(char *d, int c, uint n) {
+    uint64 vl;
+
+    push_off();
+    for(; n > 0; n -= vl, d += vl)
+        asm volatile("vsetvli %0, %1, e8, m8, ta, ma\n"
+                     "vmv.v.x v0, %2\n"
+                     "vse8.v v0, (%3)\n"
+                     : "=&r"(vl) : "r"(n), "r"(c), "r"(d)
+                     : "memory", RVV_CLOBBER_V0);
+    pop_off();
+}
+
+// 返回第一个不同字节的下标，全部相同返回n
+static uint rvv_mismatch(const uchar *a, const uchar *b, uint n) {
+    uint64 vl;
+    long idx;
+    uint off = 0;
+
+    push_off();
+    for(; off < n; off += vl){
+        asm volatile("vsetvli %0, %2, e8, m8, ta, ma\n"
+                     "vle8.v v0, (%3)\n"
+                     "vle8.v v8, (%4)\n"
+                     "vmsne.vv v16, v0, v8\n"
+                     "vfirst.m %1, v16\n"
+                     : "=&r"(vl), "=r"(idx)
+                     : "r"(n - off), "r"(a + off), "r"(b + off)
+                     : "memory", RVV_CLOBBER_V0, RVV_CLOBBER_V8, RVV_CLOBBER_V16);
+        if(idx >= 0){
+            off += idx;
+            break;
+        }
+    }
+    pop_off();
+    return off < n ? off : n;
+}
+#endif
+
+// 从低地址向高地址复制，d在s之前或两者不重叠时使用
+static void copy_fwd(char *d, const char *s, uint n) {
+    if(n >= 2 * WSIZE && ALIGNED(d, s)){
+        word_t *wd;
+        const word_t *ws;
+
+        for(; (uint64)d & WMASK; n--)
+            *d++ = *s++;
+        wd = (word_t *)d;
+        ws = (const word_t *)s;
+        for(; n >= 8 * WSIZE; n -= 8 * WSIZE, wd += 8, ws += 8){
+            word_t w0 = ws[0], w1 = ws[1], w2 = ws[2], w3 = ws[3];
+            word_t w4 = ws[4], w5 = ws[5], w6 = ws[6], w7 = ws[7];
+            wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+            wd[4] = w4; wd[5] = w5; wd[6] = w6; wd[7] = w7;
+        }
+        for(; n >= WSIZE; n -= WSIZE)
+            *wd++ = *ws++;
+        d = (char *)wd;
+        s = (const char *)ws;
+    }
+    for(; n >= 4; n -= 4, d += 4, s += 4){
+        d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3];
+    }
+    while(n-- > 0)
+        *d++ = *s++;
+}
+
+// 从高地址向低地址复制，d在s之后且两者重叠时使用
+static void copy_bwd(char *d, const char *s, uint n) {
+    d += n;
+    s += n;
+    if(n >= 2 * WSIZE && ALIGNED(d, s)){
+        word_t *wd;
+        const word_t *ws;
+
+        for(; (uint64)d & WMASK; n--)
+            *--d = *--s;
+        wd = (word_t *)d;
+        ws = (const word_t *)s;
+        for(; n >= 8 * WSIZE; n -= 8 * WSIZE){
+            wd -= 8;
+            ws -= 8;
+            word_t w0 = ws[0], w1 = ws[1], w2 = ws[2], w3 = ws[3];
+            word_t w4 = ws[4], w5 = ws[5], w6 = ws[6], w7 = ws[7];
+            wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+            wd[4] = w4; wd[5] = w5; wd[6] = w6; wd[7] = w7;
+        }
+        for(; n >= WSIZE; n -= WSIZE)
+            *--wd = *--ws;
+        d = (char *)wd;
+        s = (const char *)ws;
+    }
+    while(n-- > 0)
+        *--d = *--s;
+}
 
 void* memset(void *dst, int c, uint n) {
-    char *cdst = (char *) dst;
-    int i;
-    for(i = 0; i < n; i++){
-        cdst[i] = c;
+    char *d = (char *) dst;
+
+#ifdef CONFIG_RVV
+    if(n >= RVV_MIN){
+        rvv_set(d, c, n);
+        return dst;
+    }
+#endif
+    if(n >= 2 * WSIZE){
+        word_t w = (uchar)c * 0x0101010101010101UL;
+        word_t *wd;
+
+        for(; (uint64)d & WMASK; n--)
+            *d++ = c;
+        wd = (word_t *)d;
+        for(; n >= 8 * WSIZE; n -= 8 * WSIZE, wd += 8){
+            wd[0] = w; wd[1] = w; wd[2] = w; wd[3] = w;
+            wd[4] = w; wd[5] = w; wd[6] = w; wd[7] = w;
+        }
+        for(; n >= WSIZE; n -= WSIZE)
+            *wd++ = w;
+        d = (char *)wd;
     }
+    while(n-- > 0)
+        *d++ = c;
+    return dst;
+}
+
+// 复制不重叠的内存块
+void* memcpy(void *dst, const void *src, uint n) {
+#ifdef CONFIG_RVV
+    if(n >= RVV_MIN){
+        rvv_copy(dst, src, n);
+        return dst;
+    }
+#endif
+    copy_fwd(dst, src, n);
     return dst;
 }
 
+void* memmove(void *dst, const void *src, uint n) {
+    const char *s = src;
+    char *d = dst;
+
+    if(n == 0 || d == s)
+        return dst;
+    if(s < d && s + n > d){
+        copy_bwd(d, s, n);
+        return dst;
+    }
+#ifdef CONFIG_RVV
+    // 每轮先读入整段再写出，d在s之前时按升序处理不会覆盖未读的数据
+    if(n >= RVV_MIN){
+        rvv_copy(d, s, n);
+        return dst;
+    }
+#endif
+    copy_fwd(d, s, n);
+    return dst;
+}
+
+int memcmp(const void *v1, const void *v2, uint n) {
+    const uchar *s1 = v1, *s2 = v2;
+
+#ifdef CONFIG_RVV
+    if(n >= RVV_MIN){
+        uint i = rvv_mismatch(s1, s2, n);
+        return i < n ? s1[i] - s2[i] : 0;
+    }
+#endif
+    // 按字比较找到第一个不同的字，再逐字节确定差异
+    if(n >= 2 * WSIZE && ALIGNED(s1, s2)){
+        for(; (uint64)s1 & WMASK; n--, s1++, s2++)
+            if(*s1 != *s2)
+                return *s1 - *s2;
+        for(; n >= WSIZE; n -= WSIZE, s1 += WSIZE, s2 += WSIZE)
+            if(*(const word_t *)s1 != *(const word_t *)s2)
+                break;
+    }
+    while(n-- > 0){
+        if(*s1 != *s2)
+            return *s1 - *s2;
+        s1++, s2++;
+    }
+    return 0;
+}
+
+// 字符串函数
+
 int strlen(const char *s) {
     int n = 0;
     while(s[n])
@@ -5,6 +5,9 @@
 
 // 字符串操作函数
 void* memset(void *dst, int c, uint n);
+void* memcpy(void *dst, const void *src, uint n);
+void* memmove(void *dst, const void *src, uint n);
+int memcmp(const void *v1, const void *v2, uint n);
 int strlen(const char *s);
 int strcmp(const char *p, const char *q);
 int strncmp(const char *p, const char *q, uint n);